@@ -0,0 +1,341 @@
+#ifndef _AGGREGATORS_HH_
+#define _AGGREGATORS_HH_
+
+#include <tuple>
+#include <limits>
+#include <utility>
+#include <type_traits>
+#include <cmath>
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+
+#include "Kernels.hh"
+
+/*
+ * Aggregators for LazyIteratorBase::aggregate(sumOf(f), minOf(f), ...),
+ * which computes all of them in a single pass.
+ *
+ * sumOf(f) and the like only record f; aggregate() binds them to the
+ * value_type of the pipeline, which gives the accumulator type.
+ *
+ * Spec concept:
+ *  template<class T> auto bind() const;  the Aggregator for elements T
+ *
+ * Aggregator concept:
+ *  template<class T> void update(T const &t);
+ *  void merge(Aggregator const &other);   as if other's elements followed
+ *  auto result() const;
+ */
+
+struct AggregateIdentity {
+    template<class T>
+    T operator()(T const &t) const {
+        return t;
+    }
+};
+
+template<class F, class T>
+using aggregate_result_t = std::decay_t<std::result_of_t<F const(T const &)>>;
+
+template<class R, class F>
+struct SumAggregator {
+    F   f;
+    R   acc{};
+
+    template<class T>
+    void update(T const &t) {
+        acc += f(t);
+    }
+
+    void merge(SumAggregator const &other) {
+        acc += other.acc;
+    }
+
+    R result() const {
+        return acc;
+    }
+};
+
+template<class R, class F, bool Max>
+struct ExtremumAggregator {
+    F   f;
+    R   acc = Max ? std::numeric_limits<R>::lowest() : std::numeric_limits<R>::max();
+
+    template<class T>
+    void update(T const &t) {
+        keep(f(t));
+    }
+
+    void merge(ExtremumAggregator const &other) {
+        keep(other.acc);
+    }
+
+    R result() const {
+        return acc;
+    }
+private:
+    void keep(R const &r) {
+        if ( Max ? acc < r : r < acc ) acc = r;
+    }
+};
+
+template<class F>
+struct SumOf {
+    F   f;
+
+    template<class T>
+    auto bind() const {
+        return SumAggregator<aggregate_result_t<F, T>, F>{f};
+    }
+};
+
+template<class F>
+struct MinOf {
+    F   f;
+
+    template<class T>
+    auto bind() const {
+        return ExtremumAggregator<aggregate_result_t<F, T>, F, false>{f};
+    }
+};
+
+template<class F>
+struct MaxOf {
+    F   f;
+
+    template<class T>
+    auto bind() const {
+        return ExtremumAggregator<aggregate_result_t<F, T>, F, true>{f};
+    }
+};
+
+struct CountOf {
+    std::size_t     acc = 0;
+
+    template<class T>
+    CountOf bind() const {
+        return *this;
+    }
+
+    template<class T>
+    void update(T const &) {
+        ++acc;
+    }
+
+    void merge(CountOf const &other) {
+        acc += other.acc;
+    }
+
+    std::size_t result() const {
+        return acc;
+    }
+};
+
+/* count, mean and the sum of squared deviations m2 of a sequence */
+struct MeanVariance {
+    std::size_t     count = 0;
+    double          mean = 0;
+    double          m2 = 0;
+
+    /* Welford */
+    void update(double x) {
+        ++count;
+        double delta = x - mean;
+        mean += delta / count;
+        m2 += delta * (x - mean);
+    }
+
+    /* n elements at once, shifted by the mean so far, vectorized */
+    template<class T>
+    void updateBlock(T const *x, std::size_t n) {
+        if ( n == 0 ) return;
+        double c = count ? mean : static_cast<double>(x[0]), sums[2];
+        kernel_shifted_moments(x, n, c, sums);
+        MeanVariance block;
+        block.count = n;
+        block.mean = c + sums[0] / n;
+        block.m2 = std::max(0.0, sums[1] - sums[0] * sums[0] / n);
+        merge(block);
+    }
+
+    /* Chan et al., exact up to rounding */
+    void merge(MeanVariance const &other) {
+        if ( other.count == 0 ) return;
+        if ( count == 0 ) {
+            *this = other;
+            return;
+        }
+        double n = count + other.count,
+               delta = other.mean - mean;
+        mean += delta * other.count / n;
+        m2 += other.m2 + delta * delta * count * other.count / n;
+        count += other.count;
+    }
+
+    /* of the population */
+    double variance() const {
+        return count ? m2 / count : 0;
+    }
+
+    /* of a sample, with Bessel's correction */
+    double sampleVariance() const {
+        return count > 1 ? m2 / (count - 1) : 0;
+    }
+
+    double stddev() const {
+        return std::sqrt(variance());
+    }
+
+    friend std::ostream &operator<<(std::ostream &os, MeanVariance const &mv) {
+        os << "[n=" << mv.count << ",mean=" << mv.mean << ",var=" << mv.variance() << "]";
+        return os;
+    }
+};
+
+/* count, means, co-moment c2 and squared deviations of a sequence of pairs */
+struct CoMoments {
+    std::size_t     count = 0;
+    double          mean_x = 0;
+    double          mean_y = 0;
+    double          m2_x = 0;
+    double          m2_y = 0;
+    double          c2 = 0;
+
+    void update(double x, double y) {
+        ++count;
+        double dx = x - mean_x,
+               dy = y - mean_y;
+        mean_x += dx / count;
+        mean_y += dy / count;
+        m2_x += dx * (x - mean_x);
+        m2_y += dy * (y - mean_y);
+        c2 += dx * (y - mean_y);
+    }
+
+    template<class T, class U>
+    void updateBlock(T const *x, U const *y, std::size_t n) {
+        if ( n == 0 ) return;
+        double cx = count ? mean_x : static_cast<double>(x[0]),
+               cy = count ? mean_y : static_cast<double>(y[0]),
+               sums[5];
+        kernel_shifted_comoments(x, y, n, cx, cy, sums);
+        CoMoments block;
+        block.count = n;
+        block.mean_x = cx + sums[0] / n;
+        block.mean_y = cy + sums[1] / n;
+        block.m2_x = std::max(0.0, sums[2] - sums[0] * sums[0] / n);
+        block.m2_y = std::max(0.0, sums[3] - sums[1] * sums[1] / n);
+        block.c2 = sums[4] - sums[0] * sums[1] / n;
+        merge(block);
+    }
+
+    void merge(CoMoments const &other) {
+        if ( other.count == 0 ) return;
+        if ( count == 0 ) {
+            *this = other;
+            return;
+        }
+        double n = count + other.count,
+               dx = other.mean_x - mean_x,
+               dy = other.mean_y - mean_y,
+               w = 1.0 * count * other.count / n;
+        mean_x += dx * other.count / n;
+        mean_y += dy * other.count / n;
+        m2_x += other.m2_x + dx * dx * w;
+        m2_y += other.m2_y + dy * dy * w;
+        c2 += other.c2 + dx * dy * w;
+        count += other.count;
+    }
+
+    /* of the population */
+    double covariance() const {
+        return count ? c2 / count : 0;
+    }
+
+    double sampleCovariance() const {
+        return count > 1 ? c2 / (count - 1) : 0;
+    }
+
+    /* Pearson's, 0 when either side is constant */
+    double correlation() const {
+        double d = std::sqrt(m2_x * m2_y);
+        return d > 0 ? c2 / d : 0;
+    }
+};
+
+template<class F>
+struct MeanVar {
+    F               f;
+    MeanVariance    acc = {};
+
+    template<class T>
+    MeanVar bind() const {
+        return *this;
+    }
+
+    template<class T>
+    void update(T const &t) {
+        acc.update(static_cast<double>(f(t)));
+    }
+
+    void merge(MeanVar const &other) {
+        acc.merge(other.acc);
+    }
+
+    MeanVariance result() const {
+        return acc;
+    }
+};
+
+template<class F = AggregateIdentity>
+SumOf<F> sumOf(F f = F()) { return {f}; }
+
+template<class F = AggregateIdentity>
+MinOf<F> minOf(F f = F()) { return {f}; }
+
+template<class F = AggregateIdentity>
+MaxOf<F> maxOf(F f = F()) { return {f}; }
+
+inline CountOf countOf() { return {}; }
+
+template<class F = AggregateIdentity>
+MeanVar<F> meanVar(F f = F()) { return {f}; }
+
+template<class Spec, class T>
+using aggregate_bind_t = decltype(std::declval<Spec const &>().template bind<T>());
+
+/* a tuple of Aggregators, updated and merged together */
+template<class... Aggs>
+class Aggregation
+{
+    using self_type = Aggregation;
+public:
+    explicit Aggregation(Aggs... aggs)
+        : aggs_(std::move(aggs)...)
+    {}
+
+    template<class T>
+    void update(T const &t) {
+        std::apply([&t] (auto &... agg) { (agg.update(t), ...); }, aggs_);
+    }
+
+    void merge(self_type const &other) {
+        mergeEach(other, std::index_sequence_for<Aggs...>());
+    }
+
+    /* std::tuple of the results, in the order of the aggregators */
+    auto result() const {
+        return std::apply([] (auto const &... agg) { return std::make_tuple(agg.result()...); },
+                aggs_);
+    }
+private:
+    template<std::size_t... Is>
+    void mergeEach(self_type const &other, std::index_sequence<Is...>) {
+        (std::get<Is>(aggs_).merge(std::get<Is>(other.aggs_)), ...);
+    }
+
+    std::tuple<Aggs...>     aggs_;
+};
+
+#endif /* _AGGREGATORS_HH_ */
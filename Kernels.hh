@@ -0,0 +1,546 @@
+#ifndef _KERNELS_HH_
+#define _KERNELS_HH_
+
+#include <vector>
+#include <thread>
+#include <functional>
+#include <type_traits>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Loops over contiguous arrays, the bulk counterparts of the per element
+ * LazyIterator stages.
+ */
+
+/* number of threads to split n elements into, at least grain each */
+inline std::size_t
+kernel_threads(std::size_t n, std::size_t nthreads, std::size_t grain = 1 << 16)
+{
+    if ( nthreads == 0 ) {
+        nthreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return std::max<std::size_t>(1, std::min(nthreads, n / grain));
+}
+
+/* run work(i, begin, end) for the i-th of nblocks equal blocks of [0, n) */
+template<class Work>
+void
+kernel_parallel_blocks(std::size_t n, std::size_t nblocks, Work work)
+{
+    auto bound = [&] (std::size_t i) { return n / nblocks * i + std::min(i, n % nblocks); };
+    if ( nblocks == 1 ) {
+        work(0, 0, n);
+        return;
+    }
+    std::vector<std::thread> threads;
+    threads.reserve(nblocks - 1);
+    for ( std::size_t i = 1; i < nblocks; ++i ) {
+        threads.emplace_back(work, i, bound(i), bound(i + 1));
+    }
+    work(0, 0, bound(1));
+    for ( auto &t : threads ) {
+        t.join();
+    }
+}
+
+template<class Op, class T>
+constexpr bool kernel_is_plus_v =
+    std::is_same_v<Op, std::plus<T>> || std::is_same_v<Op, std::plus<>>;
+
+/*
+ * out[i] = op(carry, in[0], ..., in[i]) for inclusive,
+ * out[i] = op(carry, in[0], ..., in[i - 1]) for exclusive;
+ * returns the carry after the block. in may equal out.
+ */
+template<bool Inclusive, class T, class Op>
+T
+kernel_scan_block(T const *in, T *out, std::size_t n, Op op, T carry)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    if constexpr ( kernel_is_plus_v<Op, T> && std::is_integral_v<T> && sizeof(T) == 4 ) {
+        /* prefix sum inside a register: shift-add by 1 and 2 lanes */
+        __m128i c = _mm_set1_epi32(static_cast<int>(carry));
+        for ( ; i + 4 <= n; i += 4 ) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(in + i));
+            __m128i inc = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+            inc = _mm_add_epi32(inc, _mm_slli_si128(inc, 8));
+            inc = _mm_add_epi32(inc, c);
+            __m128i res = Inclusive ? inc : _mm_sub_epi32(inc, x);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), res);
+            c = _mm_shuffle_epi32(inc, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+        carry = static_cast<T>(_mm_cvtsi128_si32(c));
+    } else if constexpr ( kernel_is_plus_v<Op, T> && std::is_integral_v<T> && sizeof(T) == 8 ) {
+        __m128i c = _mm_set1_epi64x(static_cast<long long>(carry));
+        for ( ; i + 2 <= n; i += 2 ) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(in + i));
+            __m128i inc = _mm_add_epi64(_mm_add_epi64(x, _mm_slli_si128(x, 8)), c);
+            __m128i res = Inclusive ? inc : _mm_sub_epi64(inc, x);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), res);
+            c = _mm_unpackhi_epi64(inc, inc);
+        }
+        alignas(16) long long last[2];
+        _mm_store_si128(reinterpret_cast<__m128i*>(last), c);
+        carry = static_cast<T>(last[0]);
+    }
+#endif
+    for ( ; i < n; ++i ) {
+        T next = op(carry, in[i]);
+        out[i] = Inclusive ? next : carry;
+        carry = next;
+    }
+    return carry;
+}
+
+/*
+ * Two pass blocked scan: every thread reduces its block, the block sums
+ * are scanned sequentially, then every thread scans its block starting
+ * from its offset. op must be associative.
+ */
+template<bool Inclusive, class T, class Op>
+void
+kernel_parallel_scan(T const *in, T *out, std::size_t n, Op op, T init, std::size_t nthreads = 0)
+{
+    auto nblocks = kernel_threads(n, nthreads);
+    if ( nblocks == 1 ) {
+        kernel_scan_block<Inclusive>(in, out, n, op, init);
+        return;
+    }
+
+    std::vector<T> partial(nblocks);
+    kernel_parallel_blocks(n, nblocks, [&] (std::size_t b, std::size_t beg, std::size_t end) {
+        T acc = in[beg];
+        for ( auto i = beg + 1; i < end; ++i ) {
+            acc = op(acc, in[i]);
+        }
+        partial[b] = acc;
+    });
+
+    T carry = init;
+    for ( auto &p : partial ) {
+        T next = op(carry, p);
+        p = carry;
+        carry = next;
+    }
+
+    kernel_parallel_blocks(n, nblocks, [&] (std::size_t b, std::size_t beg, std::size_t end) {
+        kernel_scan_block<Inclusive>(in + beg, out + beg, end - beg, op, partial[b]);
+    });
+}
+
+#if defined(__SSE2__)
+/* x[0], x[1] as doubles */
+template<class T>
+inline __m128d
+kernel_load2_pd(T const *x)
+{
+    if constexpr ( std::is_same_v<T, double> ) {
+        return _mm_loadu_pd(x);
+    } else if constexpr ( std::is_same_v<T, float> ) {
+        return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(x))));
+    } else if constexpr ( std::is_integral_v<T> && std::is_signed_v<T> && sizeof(T) == 4 ) {
+        return _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(x)));
+    } else {
+        return _mm_set_pd(static_cast<double>(x[1]), static_cast<double>(x[0]));
+    }
+}
+
+inline double
+kernel_hsum_pd(__m128d v)
+{
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+#endif
+
+/*
+ * sums[0] = sum of d[i], sums[1] = sum of d[i]^2, for d[i] = x[i] - c;
+ * with c near the mean the sums stay small, so that
+ * sums[1] - sums[0]^2 / n is an accurate sum of squared deviations
+ */
+template<class T>
+void
+kernel_shifted_moments(T const *x, std::size_t n, double c, double sums[2])
+{
+    std::size_t i = 0;
+    double s1 = 0, s2 = 0;
+#if defined(__SSE2__)
+    /* two pairs of accumulators, 4 elements per iteration */
+    __m128d vc = _mm_set1_pd(c),
+            a1 = _mm_setzero_pd(), a2 = _mm_setzero_pd(),
+            b1 = _mm_setzero_pd(), b2 = _mm_setzero_pd();
+    for ( ; i + 4 <= n; i += 4 ) {
+        __m128d d0 = _mm_sub_pd(kernel_load2_pd(x + i), vc),
+                d1 = _mm_sub_pd(kernel_load2_pd(x + i + 2), vc);
+        a1 = _mm_add_pd(a1, d0);
+        b1 = _mm_add_pd(b1, d1);
+        a2 = _mm_add_pd(a2, _mm_mul_pd(d0, d0));
+        b2 = _mm_add_pd(b2, _mm_mul_pd(d1, d1));
+    }
+    s1 = kernel_hsum_pd(_mm_add_pd(a1, b1));
+    s2 = kernel_hsum_pd(_mm_add_pd(a2, b2));
+#endif
+    for ( ; i < n; ++i ) {
+        double d = static_cast<double>(x[i]) - c;
+        s1 += d;
+        s2 += d * d;
+    }
+    sums[0] = s1;
+    sums[1] = s2;
+}
+
+/*
+ * for dx[i] = x[i] - cx, dy[i] = y[i] - cy:
+ * sums = {sum dx, sum dy, sum dx^2, sum dy^2, sum dx * dy}
+ */
+template<class T, class U>
+void
+kernel_shifted_comoments(T const *x, U const *y, std::size_t n, double cx, double cy, double sums[5])
+{
+    std::size_t i = 0;
+    double sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+#if defined(__SSE2__)
+    __m128d vcx = _mm_set1_pd(cx), vcy = _mm_set1_pd(cy),
+            ax = _mm_setzero_pd(), ay = _mm_setzero_pd(),
+            axx = _mm_setzero_pd(), ayy = _mm_setzero_pd(), axy = _mm_setzero_pd();
+    for ( ; i + 2 <= n; i += 2 ) {
+        __m128d dx = _mm_sub_pd(kernel_load2_pd(x + i), vcx),
+                dy = _mm_sub_pd(kernel_load2_pd(y + i), vcy);
+        ax = _mm_add_pd(ax, dx);
+        ay = _mm_add_pd(ay, dy);
+        axx = _mm_add_pd(axx, _mm_mul_pd(dx, dx));
+        ayy = _mm_add_pd(ayy, _mm_mul_pd(dy, dy));
+        axy = _mm_add_pd(axy, _mm_mul_pd(dx, dy));
+    }
+    sx = kernel_hsum_pd(ax);
+    sy = kernel_hsum_pd(ay);
+    sxx = kernel_hsum_pd(axx);
+    syy = kernel_hsum_pd(ayy);
+    sxy = kernel_hsum_pd(axy);
+#endif
+    for ( ; i < n; ++i ) {
+        double dx = static_cast<double>(x[i]) - cx,
+               dy = static_cast<double>(y[i]) - cy;
+        sx += dx;
+        sy += dy;
+        sxx += dx * dx;
+        syy += dy * dy;
+        sxy += dx * dy;
+    }
+    sums[0] = sx;
+    sums[1] = sy;
+    sums[2] = sxx;
+    sums[3] = syy;
+    sums[4] = sxy;
+}
+
+/* sums of products in double for floating point, in 64 bits for integers */
+template<class T, class U = T>
+using kernel_acc_t = std::conditional_t<
+    std::is_floating_point_v<T> || std::is_floating_point_v<U>, double,
+    std::conditional_t<std::is_unsigned_v<T> && std::is_unsigned_v<U>,
+                       unsigned long long, long long>>;
+
+/*
+ * sum of op(x[i], y[i]) for i < n; floating point runs vop over pairs
+ * of doubles in two accumulators, integers are left to the compiler
+ */
+template<class T, class U, class VecOp, class Op>
+kernel_acc_t<T, U>
+kernel_zip_sum(T const *x, U const *y, std::size_t n, VecOp vop, Op op)
+{
+    using Acc = kernel_acc_t<T, U>;
+    std::size_t i = 0;
+    Acc acc = 0;
+#if defined(__SSE2__)
+    if constexpr ( std::is_same_v<Acc, double> ) {
+        __m128d a = _mm_setzero_pd(), b = _mm_setzero_pd();
+        for ( ; n - i >= 4; i += 4 ) {
+            a = _mm_add_pd(a, vop(kernel_load2_pd(x + i), kernel_load2_pd(y + i)));
+            b = _mm_add_pd(b, vop(kernel_load2_pd(x + i + 2), kernel_load2_pd(y + i + 2)));
+        }
+        acc = kernel_hsum_pd(_mm_add_pd(a, b));
+    }
+#endif
+    for ( ; i < n; ++i ) {
+        acc += op(static_cast<Acc>(x[i]), static_cast<Acc>(y[i]));
+    }
+    return acc;
+}
+
+template<class T>
+kernel_acc_t<T>
+kernel_sum(T const *x, std::size_t n)
+{
+    return kernel_zip_sum(x, x, n,
+#if defined(__SSE2__)
+            [] (__m128d a, __m128d) { return a; },
+#else
+            nullptr,
+#endif
+            [] (auto a, auto) { return a; });
+}
+
+/* sum of x[i] * y[i]; with FMA enabled, doubles run four products at a time */
+template<class T, class U>
+kernel_acc_t<T, U>
+kernel_dot(T const *x, U const *y, std::size_t n)
+{
+    std::size_t i = 0;
+    kernel_acc_t<T, U> acc = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+    if constexpr ( std::is_same_v<T, double> && std::is_same_v<U, double> ) {
+        __m256d a = _mm256_setzero_pd(), b = _mm256_setzero_pd();
+        for ( ; n - i >= 8; i += 8 ) {
+            a = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), a);
+            b = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4), b);
+        }
+        a = _mm256_add_pd(a, b);
+        acc = kernel_hsum_pd(_mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1)));
+    }
+#endif
+    return acc + kernel_zip_sum(x + i, y + i, n - i,
+#if defined(__SSE2__)
+            [] (__m128d a, __m128d b) { return _mm_mul_pd(a, b); },
+#else
+            nullptr,
+#endif
+            [] (auto a, auto b) { return a * b; });
+}
+
+/* sum of (x[i] - y[i])^2 */
+template<class T, class U>
+kernel_acc_t<T, U>
+kernel_squared_distance(T const *x, U const *y, std::size_t n)
+{
+    return kernel_zip_sum(x, y, n,
+#if defined(__SSE2__)
+            [] (__m128d a, __m128d b) { __m128d d = _mm_sub_pd(a, b); return _mm_mul_pd(d, d); },
+#else
+            nullptr,
+#endif
+            [] (auto a, auto b) { return (a - b) * (a - b); });
+}
+
+/* the first c in [p, end), or end; 16 bytes a compare */
+inline char const *
+kernel_find_byte(char const *p, char const *end, char c)
+{
+#if defined(__SSE2__)
+    __m128i needle = _mm_set1_epi8(c);
+    for ( ; end - p >= 16; p += 16 ) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if ( mask ) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for ( ; p != end; ++p ) {
+        if ( *p == c ) return p;
+    }
+    return end;
+}
+
+/* the number of c in [p, end) */
+inline std::size_t
+kernel_count_byte(char const *p, char const *end, char c)
+{
+    std::size_t cnt = 0;
+#if defined(__SSE2__)
+    __m128i needle = _mm_set1_epi8(c);
+    for ( ; end - p >= 16; p += 16 ) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p));
+        cnt += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)));
+    }
+#endif
+    for ( ; p != end; ++p ) {
+        cnt += *p == c;
+    }
+    return cnt;
+}
+
+/* the first byte of [p, end) that is one of set[0, nset), or end */
+inline char const *
+kernel_find_any_byte(char const *p, char const *end, char const *set, std::size_t nset)
+{
+    if ( nset == 1 ) {
+        return kernel_find_byte(p, end, set[0]);
+    }
+#if defined(__SSE2__)
+    for ( ; end - p >= 16; p += 16 ) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p)),
+                hits = _mm_setzero_si128();
+        for ( std::size_t k = 0; k < nset; ++k ) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8(set[k])));
+        }
+        int mask = _mm_movemask_epi8(hits);
+        if ( mask ) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for ( ; p != end; ++p ) {
+        if ( std::memchr(set, *p, nset) ) return p;
+    }
+    return end;
+}
+
+/*
+ * The first needle[0, len) in [p, end), or end. 16 candidate positions a
+ * step match both the first and the last byte of the needle before the
+ * bytes in between are compared.
+ */
+inline char const *
+kernel_find_bytes(char const *p, char const *end, char const *needle, std::size_t len)
+{
+    if ( len <= 1 ) {
+        return len ? kernel_find_byte(p, end, needle[0]) : end;
+    }
+    if ( static_cast<std::size_t>(end - p) < len ) {
+        return end;
+    }
+    char const *last = end - len;
+#if defined(__SSE2__)
+    __m128i first_byte = _mm_set1_epi8(needle[0]),
+            last_byte = _mm_set1_epi8(needle[len - 1]);
+    for ( ; last - p >= 15; p += 16 ) {
+        __m128i f = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p)),
+                l = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + len - 1));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(f, first_byte),
+                                                   _mm_cmpeq_epi8(l, last_byte)));
+        for ( ; mask; mask &= mask - 1 ) {
+            char const *at = p + __builtin_ctz(mask);
+            if ( std::memcmp(at + 1, needle + 1, len - 2) == 0 ) return at;
+        }
+    }
+#endif
+    for ( ; p <= last; ++p ) {
+        if ( *p == needle[0] && std::memcmp(p + 1, needle + 1, len - 1) == 0 ) return p;
+    }
+    return end;
+}
+
+/* integers to 64 bits in the same order, and back */
+template<class F>
+std::uint64_t
+kernel_ordered_bits(F f)
+{
+    if constexpr ( std::is_signed_v<F> ) {
+        return static_cast<std::uint64_t>(static_cast<std::int64_t>(f)) ^ (std::uint64_t(1) << 63);
+    } else {
+        return static_cast<std::uint64_t>(f);
+    }
+}
+
+template<class F>
+F
+kernel_from_ordered_bits(std::uint64_t u)
+{
+    if constexpr ( std::is_signed_v<F> ) {
+        return static_cast<F>(static_cast<std::int64_t>(u ^ (std::uint64_t(1) << 63)));
+    } else {
+        return static_cast<F>(u);
+    }
+}
+
+inline unsigned
+kernel_bits_for(std::uint64_t range)
+{
+    return range ? 64 - __builtin_clzll(range) : 0;
+}
+
+/*
+ * v[0, n) into bits bits each, bits <= 56, or'ed into out which must be
+ * zeroed and have 8 bytes of slack after the (n * bits + 7) / 8 it uses
+ */
+inline void
+kernel_bitpack(std::uint64_t const *v, std::size_t n, unsigned bits, char *out)
+{
+    if ( bits == 0 ) return;
+    for ( std::size_t i = 0; i < n; ++i ) {
+        std::size_t bit = i * bits;
+        std::uint64_t word;
+        std::memcpy(&word, out + bit / 8, 8);
+        word |= v[i] << (bit % 8);
+        std::memcpy(out + bit / 8, &word, 8);
+    }
+}
+
+/* width bytes little endian unsigned values */
+inline void
+kernel_unpack_bytes(char const *in, std::size_t n, unsigned width, std::uint64_t base, std::uint64_t *out)
+{
+    auto load = [&] (auto tag) {
+        using W = decltype(tag);
+        for ( std::size_t i = 0; i < n; ++i ) {
+            W w;
+            std::memcpy(&w, in + i * sizeof(W), sizeof(W));
+            out[i] = base + w;
+        }
+    };
+    if ( width == 1 ) load(std::uint8_t());
+    else if ( width == 2 ) load(std::uint16_t());
+    else load(std::uint32_t());
+}
+
+/* out[i] = base + the i-th value of bits bits, with the same slack */
+inline void
+kernel_bitunpack(char const *in, std::size_t n, unsigned bits, std::uint64_t base, std::uint64_t *out)
+{
+    if ( bits == 0 ) {
+        std::fill(out, out + n, base);
+        return;
+    }
+    /* whole bytes are plain loads, which vectorize */
+    if ( bits == 8 || bits == 16 || bits == 32 ) {
+        kernel_unpack_bytes(in, n, bits / 8, base, out);
+        return;
+    }
+    std::uint64_t mask = (std::uint64_t(1) << bits) - 1;
+    for ( std::size_t i = 0; i < n; ++i ) {
+        std::size_t bit = i * bits;
+        std::uint64_t word;
+        std::memcpy(&word, in + bit / 8, 8);
+        out[i] = base + ((word >> (bit % 8)) & mask);
+    }
+}
+
+/* the sum of n values of bits bits, without storing them */
+inline std::uint64_t
+kernel_bitpacked_sum(char const *in, std::size_t n, unsigned bits)
+{
+    std::uint64_t sum = 0;
+    if ( bits == 0 ) {
+        return 0;
+    }
+    if ( bits == 8 || bits == 16 || bits == 32 ) {
+        std::uint64_t buf[256];
+        for ( std::size_t i = 0; i < n; i += 256 ) {
+            auto m = std::min<std::size_t>(256, n - i);
+            kernel_unpack_bytes(in + i * (bits / 8), m, bits / 8, 0, buf);
+            for ( std::size_t j = 0; j < m; ++j ) sum += buf[j];
+        }
+        return sum;
+    }
+    std::uint64_t mask = (std::uint64_t(1) << bits) - 1;
+    for ( std::size_t i = 0; i < n; ++i ) {
+        std::size_t bit = i * bits;
+        std::uint64_t word;
+        std::memcpy(&word, in + bit / 8, 8);
+        sum += (word >> (bit % 8)) & mask;
+    }
+    return sum;
+}
+
+#endif /* _KERNELS_HH_ */
@@ -0,0 +1,778 @@
+#ifndef _LAZYCOLUMNS_HH_
+#define _LAZYCOLUMNS_HH_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <tuple>
+#include <utility>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <type_traits>
+#include <system_error>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <cstdio>
+#include <cerrno>
+
+#include "LazyIterator.hh"
+#include "LazyFile.hh"
+#include "LazyWriter.hh"
+#include "Kernels.hh"
+
+/*
+ * Column files: the elements of a pipeline stored field by field, in
+ * blocks of rows. Each block of an integer column is frame of reference
+ * or delta encoded, bit packed, whichever is smaller, and keeps its min
+ * and max; strings get a dictionary per block; floating points are
+ * stored as they are.
+ *
+ * iter.writeColumns(path) writes one, makeLazyIteratorFromColumnFile<T>(path)
+ * maps it back, skipping blocks by their stats with filterBlocks(pred)
+ * and decoding only the columns asked for with project<I...>().
+ *
+ * Layout: the blocks, then the footer (ColumnFileHeader, a kind byte per
+ * column padded to 8, then for each block its rows and a ColumnChunk per
+ * column), the footer's offset and "LZCOLEND".
+ */
+
+/*
+ * The fields of a value_type: arithmetic types and strings are one
+ * field, pairs and tuples one per element. For a struct, specialize:
+ *  using fields_type = std::tuple<...>;
+ *  static fields_type fields(T const &t);
+ *  static T make(fields_type &&f);
+ */
+template<class T, class = void>
+struct ColumnTraits {
+    using fields_type = std::tuple<T>;
+
+    static fields_type fields(T const &t) {
+        return fields_type(t);
+    }
+
+    static T make(fields_type &&f) {
+        return std::get<0>(std::move(f));
+    }
+};
+
+template<class A, class B>
+struct ColumnTraits<std::pair<A, B>> {
+    using fields_type = std::tuple<A, B>;
+
+    static fields_type fields(std::pair<A, B> const &p) {
+        return fields_type(p.first, p.second);
+    }
+
+    static std::pair<A, B> make(fields_type &&f) {
+        return {std::get<0>(std::move(f)), std::get<1>(std::move(f))};
+    }
+};
+
+template<class... Ts>
+struct ColumnTraits<std::tuple<Ts...>> {
+    using fields_type = std::tuple<Ts...>;
+
+    static fields_type fields(fields_type const &t) {
+        return t;
+    }
+
+    static fields_type make(fields_type &&f) {
+        return std::move(f);
+    }
+};
+
+template<class T, std::size_t I>
+using column_field_t = std::tuple_element_t<I, typename ColumnTraits<T>::fields_type>;
+
+template<class F>
+constexpr bool column_is_string_v = std::is_same_v<F, std::string> || std::is_same_v<F, std::string_view>;
+
+/* the kind of a column in the file: 0x10 signed, 0x20 unsigned,
+ * 0x30 floating point, 0x40 string, or'ed with the width in bytes
+ */
+template<class F>
+constexpr std::uint8_t
+column_kind()
+{
+    if constexpr ( column_is_string_v<F> ) {
+        return 0x40;
+    } else {
+        static_assert(std::is_arithmetic_v<F>, "columns of arithmetic types and strings");
+        constexpr std::uint8_t kind = std::is_floating_point_v<F> ? 0x30
+                                    : std::is_signed_v<F> ? 0x10 : 0x20;
+        return kind | sizeof(F);
+    }
+}
+
+struct ColumnFileHeader {
+    char            magic[8] = {'L', 'Z', 'C', 'O', 'L', 'S', '1', 0};
+    std::uint32_t   columns = 0;
+    std::uint32_t   pad = 0;
+    std::uint64_t   rows = 0;
+    std::uint64_t   blocks = 0;
+};
+
+/* where a column of a block is and how to decode it */
+struct ColumnChunk {
+    enum : std::uint8_t { plain, frame_of_reference, delta, dictionary };
+
+    std::uint64_t   offset = 0;
+    std::uint64_t   bytes = 0;
+    std::uint8_t    encoding = plain;
+    std::uint8_t    bits = 0;
+    std::uint8_t    pad[6] = {};
+    /* frame_of_reference: added to each value; delta: to each zigzag
+     * delta; dictionary: offset of the codes in the chunk
+     */
+    std::uint64_t   base = 0;
+    /* delta: the first value; dictionary: the number of strings */
+    std::uint64_t   first = 0;
+    /* integers as kernel_ordered_bits(), floating points as doubles, -inf
+     * and inf when the block holds a NaN; none for strings
+     */
+    std::uint64_t   min = 0;
+    std::uint64_t   max = 0;
+};
+
+template<class T>
+class ColumnFileWriter
+{
+    using Traits = ColumnTraits<T>;
+    using Fields = typename Traits::fields_type;
+    static constexpr std::size_t N = std::tuple_size_v<Fields>;
+
+    /* strings are copied, views handed to append() may not last */
+    template<class F>
+    using stored_t = std::conditional_t<column_is_string_v<F>, std::string, F>;
+
+    template<class Is>
+    struct Columns;
+
+    template<std::size_t... Is>
+    struct Columns<std::index_sequence<Is...>> {
+        using type = std::tuple<std::vector<stored_t<std::tuple_element_t<Is, Fields>>>...>;
+    };
+public:
+    /* writes path.tmp, renamed to path by close() */
+    explicit ColumnFileWriter(std::string const &path, std::size_t block_rows = 1 << 16)
+        : path_(path)
+        , tmp_(path + ".tmp")
+        , out_(tmp_)
+        , block_rows_(std::max<std::size_t>(block_rows, 1))
+    {}
+
+    ColumnFileWriter(ColumnFileWriter const &) = delete;
+    ColumnFileWriter &operator=(ColumnFileWriter const &) = delete;
+
+    /* not closed, the rows so far are discarded: no footer over a prefix */
+    ~ColumnFileWriter() {
+        if ( closed_ ) return;
+        try {
+            out_.close();
+        } catch ( std::system_error const & ) {
+        }
+        std::remove(tmp_.c_str());
+    }
+
+    void append(T const &t) {
+        auto fields = Traits::fields(t);
+        appendFields(fields, std::make_index_sequence<N>());
+        if ( ++in_block_ == block_rows_ ) {
+            flushBlock();
+        }
+    }
+
+    /* writes the last block and the footer, then renames the file into place */
+    void close() {
+        if ( closed_ ) return;
+        closed_ = true;
+        try {
+            finish();
+            if ( std::rename(tmp_.c_str(), path_.c_str()) < 0 ) {
+                throw std::system_error(errno, std::generic_category(), path_);
+            }
+        } catch ( ... ) {
+            std::remove(tmp_.c_str());
+            throw;
+        }
+    }
+private:
+    void finish() {
+        if ( in_block_ ) {
+            flushBlock();
+        }
+        std::uint64_t footer = offset_;
+        ColumnFileHeader header;
+        header.columns = N;
+        header.rows = rows_;
+        header.blocks = block_sizes_.size();
+        write(&header, sizeof(header));
+
+        std::uint8_t kinds[(N + 7) / 8 * 8] = {};
+        fillKinds(kinds, std::make_index_sequence<N>());
+        write(kinds, sizeof(kinds));
+        for ( std::size_t b = 0; b < block_sizes_.size(); ++b ) {
+            write(&block_sizes_[b], sizeof(std::uint64_t));
+            write(&chunks_[b * N], N * sizeof(ColumnChunk));
+        }
+        write(&footer, sizeof(footer));
+        write("LZCOLEND", 8);
+        out_.close();
+    }
+
+    template<std::size_t... Is>
+    void appendFields(Fields &fields, std::index_sequence<Is...>) {
+        (std::get<Is>(columns_).emplace_back(std::move(std::get<Is>(fields))), ...);
+    }
+
+    template<std::size_t... Is>
+    static void fillKinds(std::uint8_t *kinds, std::index_sequence<Is...>) {
+        ((kinds[Is] = column_kind<std::tuple_element_t<Is, Fields>>()), ...);
+    }
+
+    void flushBlock() {
+        std::apply([this] (auto &... column) { (encode(column), ...); }, columns_);
+        block_sizes_.push_back(in_block_);
+        rows_ += in_block_;
+        in_block_ = 0;
+    }
+
+    template<class F>
+    void encode(std::vector<F> &column) {
+        ColumnChunk chunk;
+        chunk.offset = offset_;
+        if constexpr ( std::is_same_v<F, std::string> ) {
+            encodeStrings(column, chunk);
+        } else if constexpr ( std::is_floating_point_v<F> ) {
+            /* a NaN orders with nothing: its block gets the widest bounds,
+             * so that no predicate on the stats skips it
+             */
+            double mn = std::numeric_limits<double>::infinity(), mx = -mn;
+            for ( F x : column ) {
+                if ( std::isnan(x) ) {
+                    mn = -std::numeric_limits<double>::infinity();
+                    mx = std::numeric_limits<double>::infinity();
+                    break;
+                }
+                mn = std::min<double>(mn, x);
+                mx = std::max<double>(mx, x);
+            }
+            std::memcpy(&chunk.min, &mn, 8);
+            std::memcpy(&chunk.max, &mx, 8);
+            write(column.data(), column.size() * sizeof(F));
+        } else {
+            encodeIntegers(column, chunk);
+        }
+        align();
+        chunk.bytes = offset_ - chunk.offset;
+        chunks_.push_back(chunk);
+        column.clear();
+    }
+
+    template<class F>
+    void encodeIntegers(std::vector<F> const &column, ColumnChunk &chunk) {
+        auto n = column.size();
+        values_.resize(n);
+        for ( std::size_t i = 0; i < n; ++i ) {
+            values_[i] = kernel_ordered_bits(column[i]);
+        }
+        auto mm = std::minmax_element(values_.begin(), values_.end());
+        chunk.min = *mm.first;
+        chunk.max = *mm.second;
+        unsigned for_bits = kernel_bits_for(chunk.max - chunk.min);
+
+        /* zigzag deltas, so small steps either way take few bits */
+        deltas_.resize(n - 1);
+        std::uint64_t zmin = ~std::uint64_t(0), zmax = 0;
+        for ( std::size_t i = 1; i < n; ++i ) {
+            auto d = static_cast<std::int64_t>(values_[i] - values_[i - 1]);
+            deltas_[i - 1] = (static_cast<std::uint64_t>(d) << 1) ^ static_cast<std::uint64_t>(d >> 63);
+            zmin = std::min(zmin, deltas_[i - 1]);
+            zmax = std::max(zmax, deltas_[i - 1]);
+        }
+        unsigned delta_bits = n > 1 ? kernel_bits_for(zmax - zmin) : 0;
+
+        if ( std::min(for_bits, delta_bits) > 56 ) {
+            chunk.encoding = ColumnChunk::plain;
+            write(values_.data(), n * 8);
+        } else if ( delta_bits < for_bits ) {
+            chunk.encoding = ColumnChunk::delta;
+            chunk.bits = delta_bits;
+            chunk.base = n > 1 ? zmin : 0;
+            chunk.first = values_[0];
+            for ( auto &z : deltas_ ) z -= zmin;
+            pack(deltas_.data(), n - 1, delta_bits);
+        } else {
+            chunk.encoding = ColumnChunk::frame_of_reference;
+            chunk.bits = for_bits;
+            chunk.base = chunk.min;
+            for ( auto &u : values_ ) u -= chunk.min;
+            pack(values_.data(), n, for_bits);
+        }
+    }
+
+    void encodeStrings(std::vector<std::string> const &column, ColumnChunk &chunk) {
+        std::unordered_map<std::string_view, std::uint32_t> codes;
+        std::vector<std::string_view> dict;
+        values_.resize(column.size());
+        for ( std::size_t i = 0; i < column.size(); ++i ) {
+            auto found = codes.emplace(column[i], static_cast<std::uint32_t>(dict.size()));
+            if ( found.second ) {
+                dict.push_back(column[i]);
+            }
+            values_[i] = found.first->second;
+        }
+        chunk.encoding = ColumnChunk::dictionary;
+        chunk.first = dict.size();
+        chunk.bits = kernel_bits_for(dict.size() - 1);
+
+        std::vector<std::uint32_t> offsets(dict.size() + 1);
+        for ( std::size_t i = 0; i < dict.size(); ++i ) {
+            offsets[i + 1] = offsets[i] + static_cast<std::uint32_t>(dict[i].size());
+        }
+        write(offsets.data(), offsets.size() * sizeof(std::uint32_t));
+        for ( auto s : dict ) {
+            write(s.data(), s.size());
+        }
+        align();
+        chunk.base = offset_ - chunk.offset;
+        pack(values_.data(), column.size(), chunk.bits);
+    }
+
+    /* with the 8 bytes of slack kernel_bitunpack() reads past the end */
+    void pack(std::uint64_t const *v, std::size_t n, unsigned bits) {
+        packed_.assign((n * bits + 7) / 8 + 8, 0);
+        kernel_bitpack(v, n, bits, packed_.data());
+        write(packed_.data(), packed_.size());
+    }
+
+    void write(void const *p, std::size_t n) {
+        out_.append(static_cast<char const *>(p), n);
+        offset_ += n;
+    }
+
+    void align() {
+        static char const zeros[8] = {};
+        write(zeros, (8 - offset_ % 8) % 8);
+    }
+
+    std::string                                 path_;
+    std::string                                 tmp_;
+    BufferedWriter                              out_;
+    std::size_t                                 block_rows_;
+    typename Columns<std::make_index_sequence<N>>::type columns_;
+    std::size_t                                 in_block_ = 0;
+    std::uint64_t                               rows_ = 0;
+    std::uint64_t                               offset_ = 0;
+    std::vector<std::uint64_t>                  block_sizes_;
+    std::vector<ColumnChunk>                    chunks_;
+    std::vector<std::uint64_t>                  values_;
+    std::vector<std::uint64_t>                  deltas_;
+    std::vector<char>                           packed_;
+    bool                                        closed_ = false;
+};
+
+/* a mapped column file and its footer */
+class ColumnFile
+{
+public:
+    explicit ColumnFile(std::string const &path)
+        : file_(path)
+    {
+        auto fail = [&path] () {
+            return std::system_error(std::make_error_code(std::errc::invalid_argument),
+                    path + ": not a column file");
+        };
+        char const *data = file_.data();
+        std::size_t size = file_.size();
+        std::uint64_t footer;
+        if ( size < 16 + sizeof(ColumnFileHeader) || std::memcmp(data + size - 8, "LZCOLEND", 8) != 0 ) {
+            throw fail();
+        }
+        std::memcpy(&footer, data + size - 16, 8);
+        if ( footer > size - 16 - sizeof(ColumnFileHeader) ) {
+            throw fail();
+        }
+        std::memcpy(&header_, data + footer, sizeof(header_));
+        char const *p = data + footer + sizeof(header_);
+        std::size_t avail = size - 16 - footer - sizeof(header_),
+                    kinds_size = (std::size_t(header_.columns) + 7) / 8 * 8,
+                    block_size = 8 + header_.columns * sizeof(ColumnChunk);
+        if ( std::memcmp(header_.magic, ColumnFileHeader().magic, 8) != 0
+                || kinds_size > avail || (avail - kinds_size) / block_size < header_.blocks ) {
+            throw fail();
+        }
+        kinds_.assign(p, p + header_.columns);
+        p += kinds_size;
+
+        rows_.resize(header_.blocks);
+        chunks_.resize(header_.blocks * header_.columns);
+        std::uint64_t total = 0;
+        for ( std::size_t b = 0; b < header_.blocks; ++b ) {
+            std::memcpy(&rows_[b], p, 8);
+            std::memcpy(&chunks_[b * header_.columns], p + 8, header_.columns * sizeof(ColumnChunk));
+            p += block_size;
+            /* no empty blocks, and no more rows than bytes could hold */
+            if ( rows_[b] == 0 || rows_[b] > footer || rows_[b] > header_.rows - total ) {
+                throw fail();
+            }
+            total += rows_[b];
+            for ( std::size_t c = 0; c < header_.columns; ++c ) {
+                auto const &chunk = this->chunk(b, c);
+                if ( chunk.offset > footer || chunk.bytes > footer - chunk.offset
+                        || !fits(chunk, kinds_[c], rows_[b]) ) {
+                    throw fail();
+                }
+            }
+        }
+        if ( total != header_.rows ) {
+            throw fail();
+        }
+        path_ = path;
+    }
+
+    std::string const &path() const {
+        return path_;
+    }
+
+    std::size_t columns() const {
+        return header_.columns;
+    }
+
+    std::uint8_t kind(std::size_t column) const {
+        return kinds_[column];
+    }
+
+    std::size_t blocks() const {
+        return header_.blocks;
+    }
+
+    std::size_t rows() const {
+        return header_.rows;
+    }
+
+    std::size_t rows(std::size_t block) const {
+        return rows_[block];
+    }
+
+    ColumnChunk const &chunk(std::size_t block, std::size_t column) const {
+        return chunks_[block * header_.columns + column];
+    }
+
+    char const *data(ColumnChunk const &chunk) const {
+        return file_.data() + chunk.offset;
+    }
+private:
+    /* what pack() wrote for n values, slack included */
+    static std::uint64_t packed(std::uint64_t n, unsigned bits) {
+        return (n * bits + 7) / 8 + 8;
+    }
+
+    /* everything decode() reads of a chunk of n rows lies within its bytes;
+     * only the dictionary codes are left, checked as they are unpacked
+     */
+    bool fits(ColumnChunk const &chunk, std::uint8_t kind, std::uint64_t n) const {
+        if ( chunk.bits > 56 ) return false;
+        switch ( kind & 0xf0 ) {
+        case 0x30:
+            return chunk.encoding == ColumnChunk::plain && n * (kind & 0x0f) <= chunk.bytes;
+        case 0x10:
+        case 0x20:
+            switch ( chunk.encoding ) {
+            case ColumnChunk::plain:
+                return n * 8 <= chunk.bytes;
+            case ColumnChunk::frame_of_reference:
+                return packed(n, chunk.bits) <= chunk.bytes;
+            case ColumnChunk::delta:
+                return packed(n - 1, chunk.bits) <= chunk.bytes;
+            default:
+                return false;
+            }
+        case 0x40: {
+            if ( chunk.encoding != ColumnChunk::dictionary || chunk.first == 0
+                    || chunk.first >= chunk.bytes / 4 || chunk.base > chunk.bytes
+                    || packed(n, chunk.bits) > chunk.bytes - chunk.base ) {
+                return false;
+            }
+            /* offsets ascending, into the characters before the codes */
+            std::uint64_t table = (chunk.first + 1) * 4;
+            if ( table > chunk.base ) return false;
+            char const *p = data(chunk);
+            std::uint32_t prev = 0, o;
+            for ( std::uint64_t i = 0; i <= chunk.first; ++i ) {
+                std::memcpy(&o, p + i * 4, 4);
+                if ( o < prev ) return false;
+                prev = o;
+            }
+            return prev <= chunk.base - table;
+        }
+        default:
+            return false;
+        }
+    }
+
+    MappedFile                  file_;
+    std::string                 path_;
+    ColumnFileHeader            header_;
+    std::vector<std::uint8_t>   kinds_;
+    std::vector<std::uint64_t>  rows_;
+    std::vector<ColumnChunk>    chunks_;
+};
+
+/* the stats of a block of a column file of T, for filterBlocks() */
+template<class T>
+class ColumnStats
+{
+public:
+    ColumnStats(ColumnFile const &file, std::size_t block)
+        : file_(file)
+        , block_(block)
+    {}
+
+    std::size_t rows() const {
+        return file_.rows(block_);
+    }
+
+    template<std::size_t I>
+    column_field_t<T, I> min() const {
+        return decode<I>(file_.chunk(block_, I).min);
+    }
+
+    template<std::size_t I>
+    column_field_t<T, I> max() const {
+        return decode<I>(file_.chunk(block_, I).max);
+    }
+private:
+    template<std::size_t I>
+    static column_field_t<T, I> decode(std::uint64_t u) {
+        using F = column_field_t<T, I>;
+        static_assert(!column_is_string_v<F>, "string columns have no stats");
+        if constexpr ( std::is_floating_point_v<F> ) {
+            double d;
+            std::memcpy(&d, &u, 8);
+            return static_cast<F>(d);
+        } else {
+            return kernel_from_ordered_bits<F>(u);
+        }
+    }
+
+    ColumnFile const    &file_;
+    std::size_t         block_;
+};
+
+/*
+ * The rows of a column file of T, block by block. All columns make Ts;
+ * project<I, J...>() decodes only columns I, J... and makes their fields,
+ * or tuples of them. std::string_view fields point into the mapping,
+ * valid while an iterator over the file lives.
+ */
+template<class T, bool Whole, std::size_t... Is>
+class LazyIteratorWithColumnFile
+    : public LazyIteratorBase<LazyIteratorWithColumnFile<T, Whole, Is...>>
+{
+    using self_type = LazyIteratorWithColumnFile;
+    using Traits = ColumnTraits<T>;
+
+    template<class, bool, std::size_t...>
+    friend class LazyIteratorWithColumnFile;
+
+    template<std::size_t I>
+    using field_t = column_field_t<T, I>;
+
+    using fields_type = std::tuple<field_t<Is>...>;
+public:
+    using value_type = std::conditional_t<Whole, T,
+          std::conditional_t<sizeof...(Is) == 1, std::tuple_element_t<0, fields_type>, fields_type>>;
+    using stats_pred = std::function<bool (ColumnStats<T> const &)>;
+
+    LazyIteratorWithColumnFile(std::shared_ptr<ColumnFile const> file, stats_pred keep,
+                               std::size_t block, std::size_t row)
+        : file_(std::move(file))
+        , keep_(std::move(keep))
+        , next_block_(block)
+        , skip_rows_(row)
+    {}
+
+    self_type &operator++() {
+        must_ok();
+        ++row_;
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        self_type res = *this;
+        ++row_;
+        return res;
+    }
+
+    value_type operator*() {
+        must_ok();
+        return make(std::make_index_sequence<sizeof...(Is)>());
+    }
+
+    bool ok() {
+        while ( row_ == rows_ && next_block_ < file_->blocks() ) {
+            load(next_block_++);
+        }
+        return row_ < rows_;
+    }
+
+    /* from the stats alone, nothing is decoded */
+    std::size_t count() {
+        std::size_t n = rows_ - row_;
+        for ( ; next_block_ < file_->blocks(); ++next_block_ ) {
+            if ( kept(next_block_) ) {
+                n += file_->rows(next_block_);
+            }
+        }
+        n -= std::min(n, skip_rows_);
+        row_ = rows_;
+        return n;
+    }
+
+    /*
+     * Pred: bool (ColumnStats<T> const &), false to skip the block
+     *
+     * for the blocks not loaded yet; rows of kept blocks still need a
+     * filter() of their own
+     */
+    template<class Pred>
+    self_type filterBlocks(Pred pred) {
+        self_type res = *this;
+        if ( keep_ ) {
+            res.keep_ = [prev = keep_, pred] (ColumnStats<T> const &s) { return prev(s) && pred(s); };
+        } else {
+            res.keep_ = pred;
+        }
+        return res;
+    }
+
+    /* the same rows from here, decoding the columns Js only */
+    template<std::size_t... Js>
+    auto project() {
+        static_assert(sizeof...(Js) > 0, "project needs a column");
+        std::size_t block = next_block_, row = 0;
+        if ( row_ < rows_ ) {
+            block = current_;
+            row = row_;
+        }
+        return LazyIteratorWithColumnFile<T, false, Js...>(file_, keep_, block, row);
+    }
+private:
+    bool kept(std::size_t block) const {
+        return !keep_ || keep_(ColumnStats<T>(*file_, block));
+    }
+
+    void load(std::size_t block) {
+        row_ = rows_ = 0;
+        if ( !kept(block) ) return;
+        current_ = block;
+        rows_ = file_->rows(block);
+        decodeAll(block, std::make_index_sequence<sizeof...(Is)>());
+        row_ = std::min(skip_rows_, rows_);
+        skip_rows_ = 0;
+    }
+
+    /* Ks: the positions of the columns Is in columns_ */
+    template<std::size_t... Ks>
+    value_type make(std::index_sequence<Ks...>) const {
+        if constexpr ( Whole ) {
+            return Traits::make(typename Traits::fields_type(std::get<Ks>(columns_)[row_]...));
+        } else if constexpr ( sizeof...(Is) == 1 ) {
+            return std::get<0>(columns_)[row_];
+        } else {
+            return value_type(std::get<Ks>(columns_)[row_]...);
+        }
+    }
+
+    template<std::size_t... Ks>
+    void decodeAll(std::size_t block, std::index_sequence<Ks...>) {
+        (decode<Is>(block, std::get<Ks>(columns_)), ...);
+    }
+
+    template<std::size_t I, class F>
+    void decode(std::size_t block, std::vector<F> &out) {
+        auto const &chunk = file_->chunk(block, I);
+        char const *p = file_->data(chunk);
+        std::size_t n = rows_;
+        out.resize(n);
+        if constexpr ( column_is_string_v<F> ) {
+            std::size_t ndict = chunk.first;
+            auto offset = [p] (std::size_t i) {
+                std::uint32_t o;
+                std::memcpy(&o, p + i * 4, 4);
+                return o;
+            };
+            char const *chars = p + (ndict + 1) * 4;
+            values_.resize(n);
+            kernel_bitunpack(p + chunk.base, n, chunk.bits, 0, values_.data());
+            for ( std::size_t i = 0; i < n; ++i ) {
+                if ( values_[i] >= ndict ) {
+                    throw std::system_error(std::make_error_code(std::errc::invalid_argument),
+                            file_->path() + ": dictionary code out of range");
+                }
+                auto beg = offset(values_[i]);
+                out[i] = F(std::string_view(chars + beg, offset(values_[i] + 1) - beg));
+            }
+        } else if constexpr ( std::is_floating_point_v<F> ) {
+            std::memcpy(out.data(), p, n * sizeof(F));
+        } else {
+            values_.resize(n);
+            if ( chunk.encoding == ColumnChunk::plain ) {
+                std::memcpy(values_.data(), p, n * 8);
+            } else if ( chunk.encoding == ColumnChunk::frame_of_reference ) {
+                kernel_bitunpack(p, n, chunk.bits, chunk.base, values_.data());
+            } else {
+                values_[0] = chunk.first;
+                kernel_bitunpack(p, n - 1, chunk.bits, chunk.base, values_.data() + 1);
+                for ( std::size_t i = 1; i < n; ++i ) {
+                    std::uint64_t z = values_[i];
+                    values_[i] = values_[i - 1] + ((z >> 1) ^ (~(z & 1) + 1));
+                }
+            }
+            for ( std::size_t i = 0; i < n; ++i ) {
+                out[i] = kernel_from_ordered_bits<F>(values_[i]);
+            }
+        }
+    }
+
+    std::shared_ptr<ColumnFile const>       file_;
+    stats_pred                              keep_;
+    std::size_t                             next_block_;
+    std::size_t                             skip_rows_;
+    std::size_t                             current_ = 0;
+    std::size_t                             row_ = 0;
+    std::size_t                             rows_ = 0;
+    std::tuple<std::vector<field_t<Is>>...> columns_;
+    std::vector<std::uint64_t>              values_;
+};
+
+template<class T, std::size_t... Is>
+auto
+makeLazyIteratorFromColumnFile(std::shared_ptr<ColumnFile const> file, std::index_sequence<Is...>)
+{
+    using Fields = typename ColumnTraits<T>::fields_type;
+    bool same = file->columns() == sizeof...(Is)
+        && ((file->kind(Is) == column_kind<std::tuple_element_t<Is, Fields>>()) && ...);
+    if ( !same ) {
+        throw std::system_error(std::make_error_code(std::errc::invalid_argument),
+                file->path() + ": other column types");
+    }
+    return LazyIteratorWithColumnFile<T, true, Is...>(std::move(file), {}, 0, 0);
+}
+
+/* the columns must be those of T, or std::system_error */
+template<class T>
+auto
+makeLazyIteratorFromColumnFile(std::string const &path)
+{
+    return makeLazyIteratorFromColumnFile<T>(std::make_shared<ColumnFile const>(path),
+            std::make_index_sequence<std::tuple_size_v<typename ColumnTraits<T>::fields_type>>());
+}
+
+#endif /* _LAZYCOLUMNS_HH_ */
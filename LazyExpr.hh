@@ -0,0 +1,285 @@
+#ifndef _LAZYEXPR_HH_
+#define _LAZYEXPR_HH_
+
+#include <tuple>
+#include <utility>
+#include <functional>
+#include <type_traits>
+#include <algorithm>
+#include <cstddef>
+
+/*
+ * Placeholder expressions: _1 % 2 == 0, _1 * _1 % 10000, _1.second > 4
+ *
+ * An expression is a tree of nodes in its type, so it can be inspected at
+ * compile time. Called like a lambda it is evaluated element by element.
+ * evalBatch() evaluates it over whole columns in one loop without calls,
+ * which compilers vectorize like a hand written loop.
+ *
+ * Node concept:
+ *  decltype(auto) eval(Args const &... args) const;
+ */
+
+constexpr std::size_t lazy_expr_batch = 1024;
+
+struct LazyExprTag {};
+
+template<class T>
+constexpr bool is_lazy_expr_v = std::is_base_of_v<LazyExprTag, std::decay_t<T>>;
+
+template<class Node, class... Ts>
+using lazy_expr_result_t = std::decay_t<
+    decltype(std::declval<Node const&>().eval(std::declval<Ts const&>()...))>;
+
+template<class Node>
+struct LazyExpr
+    : Node
+    , LazyExprTag
+{
+    using node_type = Node;
+
+    LazyExpr() = default;
+
+    explicit LazyExpr(Node node)
+        : Node(std::move(node))
+    {}
+
+    /* by value: a map() over an expression must not yield references */
+    template<class... Args>
+    auto operator()(Args const &... args) const {
+        return this->eval(args...);
+    }
+
+    /* out[i] = (*this)(in[i]...) for i < n */
+    template<class R, class... Ts>
+    void evalBatch(R *out, std::size_t n, Ts const *... in) const {
+        for ( std::size_t i = 0; i < n; ++i ) {
+            out[i] = this->eval(in[i]...);
+        }
+    }
+};
+
+/* the I-th argument */
+template<std::size_t I>
+struct ExprArg {
+    template<class... Args>
+    decltype(auto) eval(Args const &... args) const {
+        return std::get<I>(std::forward_as_tuple(args...));
+    }
+};
+
+template<class T>
+struct ExprConst {
+    T v;
+
+    template<class... Args>
+    T const &eval(Args const &...) const {
+        return v;
+    }
+};
+
+/* a constant known at compile time, e.g. _1 % _c<10000> */
+template<auto V>
+struct ExprStatic {
+    template<class... Args>
+    constexpr auto eval(Args const &...) const {
+        return V;
+    }
+};
+
+template<class Op, class E>
+struct ExprUnary {
+    E e;
+
+    template<class... Args>
+    auto eval(Args const &... args) const {
+        return Op{}(e.eval(args...));
+    }
+};
+
+/* an integer constant, given at run time or compile time */
+template<class E>
+struct expr_integer_constant : std::false_type {};
+
+template<class T>
+struct expr_integer_constant<LazyExpr<ExprConst<T>>> : std::is_integral<T> {};
+
+template<auto V>
+struct expr_integer_constant<LazyExpr<ExprStatic<V>>> : std::is_integral<decltype(V)> {};
+
+template<class Op, class L, class R>
+struct ExprBinary {
+    L l;
+    R r;
+
+    /* x % 2^k and x / 2^k by a constant become a mask and a shift; the
+     * test on shift_ does not depend on the element, so it is hoisted
+     * out of evalBatch() loops
+     */
+    static constexpr bool by_constant = expr_integer_constant<R>::value
+        && (std::is_same_v<Op, std::modulus<>> || std::is_same_v<Op, std::divides<>>);
+
+    ExprBinary(L l, R r)
+        : l(std::move(l))
+        , r(std::move(r))
+    {
+        if constexpr ( by_constant ) {
+            auto d = this->r.eval();
+            if ( d > 0 && (d & (d - 1)) == 0 ) {
+                shift_ = 0;
+                while ( (decltype(d)(1) << shift_) != d ) ++shift_;
+            }
+        }
+    }
+
+    template<class... Args>
+    auto eval(Args const &... args) const {
+        if constexpr ( by_constant ) {
+            auto x = l.eval(args...);
+            using Res = decltype(Op{}(x, r.eval()));
+            if constexpr ( std::is_integral_v<decltype(x)> ) {
+                if ( shift_ >= 0 ) {
+                    return pow2(static_cast<Res>(x));
+                }
+            }
+            return Op{}(x, r.eval());
+        } else {
+            return Op{}(l.eval(args...), r.eval(args...));
+        }
+    }
+private:
+    template<class T>
+    T pow2(T x) const {
+        T mask = (T(1) << shift_) - 1;
+        if constexpr ( std::is_same_v<Op, std::modulus<>> ) {
+            T rem = x & mask;
+            if constexpr ( std::is_signed_v<T> ) {
+                /* the remainder takes the sign of x */
+                rem -= (x < 0 && rem != 0) ? (mask + 1) : 0;
+            }
+            return rem;
+        } else {
+            if constexpr ( std::is_signed_v<T> ) {
+                /* round toward zero */
+                x += (x >> (sizeof(T) * 8 - 1)) & mask;
+            }
+            return x >> shift_;
+        }
+    }
+
+    int shift_ = -1;
+};
+
+/* e.first / e.second */
+template<class E, bool Second>
+struct ExprMember {
+    E e;
+
+    /* a reference into an argument, a copy out of a temporary */
+    template<class... Args>
+    decltype(auto) eval(Args const &... args) const {
+        using Whole = decltype(e.eval(args...));
+        auto &&whole = e.eval(args...);
+        if constexpr ( std::is_lvalue_reference_v<Whole> ) {
+            if constexpr ( Second ) return (whole.second); else return (whole.first);
+        } else {
+            if constexpr ( Second ) {
+                return std::decay_t<decltype(whole.second)>(whole.second);
+            } else {
+                return std::decay_t<decltype(whole.first)>(whole.first);
+            }
+        }
+    }
+};
+
+template<std::size_t I>
+struct ExprPlaceholder
+    : LazyExpr<ExprArg<I>>
+{
+    LazyExpr<ExprMember<LazyExpr<ExprArg<I>>, false>>  first;
+    LazyExpr<ExprMember<LazyExpr<ExprArg<I>>, true>>   second;
+};
+
+template<class T>
+auto
+as_lazy_expr(T const &t)
+{
+    if constexpr ( is_lazy_expr_v<T> ) {
+        return static_cast<LazyExpr<typename T::node_type> const &>(t);
+    } else {
+        return LazyExpr<ExprConst<std::decay_t<T>>>(ExprConst<std::decay_t<T>>{t});
+    }
+}
+
+#define define_lazy_expr_binary(OP, FUNCTOR)                                    \
+    template<class L, class R,                                                  \
+             class = std::enable_if_t<is_lazy_expr_v<L> || is_lazy_expr_v<R>>>  \
+    auto operator OP(L const &l, R const &r) {                                  \
+        using LE = decltype(as_lazy_expr(l));                                   \
+        using RE = decltype(as_lazy_expr(r));                                   \
+        using Node = ExprBinary<FUNCTOR, LE, RE>;                               \
+        return LazyExpr<Node>(Node{as_lazy_expr(l), as_lazy_expr(r)});          \
+    }
+
+#define define_lazy_expr_unary(OP, FUNCTOR)                                     \
+    template<class E, class = std::enable_if_t<is_lazy_expr_v<E>>>              \
+    auto operator OP(E const &e) {                                              \
+        using EE = decltype(as_lazy_expr(e));                                   \
+        using Node = ExprUnary<FUNCTOR, EE>;                                    \
+        return LazyExpr<Node>(Node{as_lazy_expr(e)});                           \
+    }
+
+define_lazy_expr_binary(+, std::plus<>)
+define_lazy_expr_binary(-, std::minus<>)
+define_lazy_expr_binary(*, std::multiplies<>)
+define_lazy_expr_binary(/, std::divides<>)
+define_lazy_expr_binary(%, std::modulus<>)
+define_lazy_expr_binary(==, std::equal_to<>)
+define_lazy_expr_binary(!=, std::not_equal_to<>)
+define_lazy_expr_binary(<, std::less<>)
+define_lazy_expr_binary(>, std::greater<>)
+define_lazy_expr_binary(<=, std::less_equal<>)
+define_lazy_expr_binary(>=, std::greater_equal<>)
+define_lazy_expr_binary(&&, std::logical_and<>)
+define_lazy_expr_binary(||, std::logical_or<>)
+define_lazy_expr_binary(&, std::bit_and<>)
+define_lazy_expr_binary(|, std::bit_or<>)
+define_lazy_expr_binary(^, std::bit_xor<>)
+define_lazy_expr_unary(-, std::negate<>)
+define_lazy_expr_unary(!, std::logical_not<>)
+
+#undef define_lazy_expr_binary
+#undef define_lazy_expr_unary
+
+/* _1 % k == r, k and r integer constants; sources that can select those
+ * elements without testing each one look for it
+ */
+template<class E>
+struct lazy_expr_mod_eq : std::false_type {};
+
+template<class K, class R>
+struct lazy_expr_mod_eq<LazyExpr<ExprBinary<std::equal_to<>,
+                        LazyExpr<ExprBinary<std::modulus<>, LazyExpr<ExprArg<0>>, K>>, R>>>
+    : std::bool_constant<expr_integer_constant<K>::value && expr_integer_constant<R>::value>
+{
+    template<class E>
+    static auto modulus(E const &e) {
+        return e.l.r.eval();
+    }
+
+    template<class E>
+    static auto remainder(E const &e) {
+        return e.r.eval();
+    }
+};
+
+/* using namespace lazy_placeholders; */
+namespace lazy_placeholders {
+    inline constexpr ExprPlaceholder<0> _1{};
+    inline constexpr ExprPlaceholder<1> _2{};
+
+    template<auto V>
+    inline constexpr LazyExpr<ExprStatic<V>> _c{};
+}
+
+#endif /* _LAZYEXPR_HH_ */
@@ -0,0 +1,1238 @@
+#ifndef _LAZYFILE_HH_
+#define _LAZYFILE_HH_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <system_error>
+#include <stdexcept>
+#include <functional>
+#include <iterator>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <deque>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+/* IORING_OP_READ and IORING_REGISTER_PROBE both came with Linux 5.6 */
+#if defined(IO_URING_OP_SUPPORTED)
+#define LAZY_HAVE_IO_URING 1
+#else
+#define LAZY_HAVE_IO_URING 0
+#endif
+
+#include "LazyIterator.hh"
+#include "LazyWriter.hh"
+#include "Kernels.hh"
+
+/*
+ * Lazy iterators reading files. Records are std::string_views into the
+ * iterator's own buffers or mappings, so they stay valid only as long as
+ * noted for each source; copy them into std::strings to keep them.
+ *
+ * Failures to open or read throw std::system_error.
+ */
+
+/* a whole file mapped read only, shared by the iterators over it;
+ * advice for madvise(), sequential reads by default
+ */
+class MappedFile
+{
+public:
+    explicit MappedFile(std::string const &path, int advice = MADV_SEQUENTIAL) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if ( fd < 0 ) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        struct stat st;
+        if ( ::fstat(fd, &st) < 0 ) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), path);
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        if ( size_ > 0 ) {
+            void *addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if ( addr == MAP_FAILED ) {
+                int err = errno;
+                ::close(fd);
+                throw std::system_error(err, std::generic_category(), path);
+            }
+            /* read ahead aggressively, drop pages behind */
+            ::madvise(addr, size_, advice);
+            data_ = static_cast<char const *>(addr);
+        }
+        ::close(fd);
+    }
+
+    MappedFile(MappedFile const &) = delete;
+    MappedFile &operator=(MappedFile const &) = delete;
+
+    ~MappedFile() {
+        if ( data_ ) {
+            ::munmap(const_cast<char *>(data_), size_);
+        }
+    }
+
+    char const *data() const {
+        return data_;
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+private:
+    char const      *data_ = nullptr;
+    std::size_t     size_ = 0;
+};
+
+/*
+ * The lines of a mapped file without their '\n', as std::string_views
+ * into the mapping, valid while any iterator over the file lives. A last
+ * line without '\n' is a line too.
+ *
+ * split(n) cuts the remaining lines into n parts at line boundaries, for
+ * parallelSplits(), and leaves this iterator empty.
+ */
+class LazyIteratorWithFileLines
+    : public LazyIteratorBase<LazyIteratorWithFileLines>
+{
+    using self_type = LazyIteratorWithFileLines;
+public:
+    using value_type = std::string_view;
+
+    explicit LazyIteratorWithFileLines(std::string const &path)
+        : file_(std::make_shared<MappedFile>(path))
+        , cur_(file_->data())
+        , end_(file_->data() + file_->size())
+    {
+        seek();
+    }
+
+    self_type &operator++() {
+        must_ok();
+        seek();
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        self_type res = *this;
+        seek();
+        return res;
+    }
+
+    value_type operator*() {
+        must_ok();
+        return line_;
+    }
+
+    bool ok() {
+        return ok_;
+    }
+
+    /* counts the '\n's without cutting lines */
+    std::size_t count() {
+        if ( !ok_ ) {
+            return 0;
+        }
+        std::size_t cnt = 1 + kernel_count_byte(cur_, end_, '\n');
+        if ( cur_ != end_ && end_[-1] != '\n' ) {
+            ++cnt;
+        }
+        cur_ = end_;
+        ok_ = false;
+        return cnt;
+    }
+
+    std::vector<self_type> split(std::size_t n) {
+        std::vector<self_type> parts;
+        char const *start = ok_ ? line_.data() : end_,
+                   *beg = start;
+        auto len = static_cast<std::size_t>(end_ - start);
+        n = std::max<std::size_t>(n, 1);
+        for ( std::size_t i = 0; i < n; ++i ) {
+            char const *end = i + 1 == n ? end_ : lineStart(start + len / n * (i + 1), beg);
+            parts.push_back(self_type(file_, beg, end));
+            beg = end;
+        }
+        cur_ = end_;
+        ok_ = false;
+        return parts;
+    }
+private:
+    LazyIteratorWithFileLines(std::shared_ptr<MappedFile const> file,
+                              char const *beg, char const *end)
+        : file_(std::move(file))
+        , cur_(beg)
+        , end_(end)
+    {
+        seek();
+    }
+
+    void seek() {
+        if ( cur_ == end_ ) {
+            ok_ = false;
+            return;
+        }
+        char const *nl = kernel_find_byte(cur_, end_, '\n');
+        line_ = std::string_view(cur_, nl - cur_);
+        cur_ = nl == end_ ? end_ : nl + 1;
+        ok_ = true;
+    }
+
+    /* the start of the line holding p, or of the next one; not before min */
+    char const *lineStart(char const *p, char const *min) {
+        if ( p <= min ) {
+            return min;
+        }
+        char const *nl = kernel_find_byte(p - 1, end_, '\n');
+        return nl == end_ ? end_ : nl + 1;
+    }
+
+    std::shared_ptr<MappedFile const>   file_;
+    char const                          *cur_;
+    char const                          *end_;
+    std::string_view                    line_;
+    bool                                ok_ = false;
+};
+
+inline auto
+makeLazyIteratorFromFileLines(std::string const &path)
+{
+    return LazyIteratorWithFileLines(path);
+}
+
+/*
+ * Reads a file descriptor on a background thread into nbuffers rotating
+ * blocks, while the records of the previous blocks are consumed; for
+ * pipes and stdin, which cannot be mapped. Records are lines without
+ * their '\n' (record_size == 0) or record_size bytes each, the last one
+ * possibly shorter.
+ *
+ * A record is a view into a block. Only a record straddling blocks is
+ * copied, into carry_; a block is given back to the reader when the
+ * record after its last one is sought. The fd is not closed.
+ */
+class FdReader
+{
+public:
+    FdReader(int fd, std::size_t record_size, std::size_t block_size, std::size_t nbuffers)
+        : fd_(fd)
+        , record_size_(record_size)
+        , block_size_(std::max(block_size, std::size_t(1)))
+        , buffers_(std::max(nbuffers, std::size_t(2)))
+        , lengths_(buffers_.size())
+    {
+        for ( auto &buf : buffers_ ) {
+            buf.reset(new char[block_size_]);
+        }
+        if ( ::pipe2(wake_, O_CLOEXEC) < 0 ) {
+            throw std::system_error(errno, std::generic_category(), "pipe2");
+        }
+        reader_ = std::thread([this] () { readBlocks(); });
+    }
+
+    FdReader(FdReader const &) = delete;
+    FdReader &operator=(FdReader const &) = delete;
+
+    ~FdReader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        /* wakes up the reader blocked in poll() on an idle pipe */
+        char c = 0;
+        (void)!::write(wake_[1], &c, 1);
+        reader_.join();
+        ::close(wake_[0]);
+        ::close(wake_[1]);
+    }
+
+    bool ok() {
+        started();
+        return ok_;
+    }
+
+    std::string_view record() {
+        started();
+        return record_;
+    }
+
+    void next() {
+        started();
+        seek();
+    }
+private:
+    void started() {
+        if ( !started_ ) {
+            started_ = true;
+            seek();
+        }
+    }
+
+    void seek() {
+        if ( from_carry_ ) {
+            carry_.clear();
+            from_carry_ = false;
+        }
+        for ( ;; ) {
+            /* the block of the last record is released only now */
+            if ( pos_ == end_ ) {
+                release();
+                if ( !acquire() ) {
+                    ok_ = !carry_.empty();
+                    record_ = carry_;
+                    from_carry_ = true;
+                    return;
+                }
+            }
+            char const *stop = record_size_
+                ? pos_ + std::min<std::size_t>(end_ - pos_, record_size_ - carry_.size())
+                : kernel_find_byte(pos_, end_, '\n');
+            bool whole = record_size_ ? carry_.size() + (stop - pos_) == record_size_ : stop != end_;
+            if ( whole && carry_.empty() ) {
+                record_ = std::string_view(pos_, stop - pos_);
+            } else {
+                carry_.append(pos_, stop);
+                record_ = carry_;
+                from_carry_ = true;
+            }
+            pos_ = record_size_ || stop == end_ ? stop : stop + 1;
+            if ( whole ) {
+                ok_ = true;
+                return;
+            }
+        }
+    }
+
+    /* the next filled block into [pos_, end_), false at the end */
+    bool acquire() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] () { return consumed_ < filled_ || done_; });
+        if ( consumed_ == filled_ ) {
+            if ( error_ ) {
+                throw std::system_error(error_, std::generic_category(), "read");
+            }
+            return false;
+        }
+        auto i = consumed_ % buffers_.size();
+        pos_ = buffers_[i].get();
+        end_ = pos_ + lengths_[i];
+        holding_ = true;
+        return true;
+    }
+
+    void release() {
+        if ( !holding_ ) return;
+        holding_ = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++consumed_;
+        }
+        cv_.notify_all();
+    }
+
+    void readBlocks() {
+        for ( ;; ) {
+            std::size_t i;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] () { return stop_ || filled_ - consumed_ < buffers_.size(); });
+                if ( stop_ ) return;
+                i = filled_ % buffers_.size();
+            }
+
+            std::size_t got = 0;
+            int err = 0;
+            bool eof = false, stop = false;
+            while ( got < block_size_ ) {
+                /* hand over what is there rather than wait for a slow writer */
+                if ( !waitReadable(got == 0 ? -1 : 0, stop) ) break;
+                ssize_t n = ::read(fd_, buffers_[i].get() + got, block_size_ - got);
+                if ( n < 0 ) {
+                    if ( errno == EINTR || errno == EAGAIN ) continue;
+                    err = errno;
+                    break;
+                }
+                if ( n == 0 ) {
+                    eof = true;
+                    break;
+                }
+                got += n;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                lengths_[i] = got;
+                if ( got > 0 ) ++filled_;
+                error_ = err;
+                done_ = eof || err || stop;
+            }
+            cv_.notify_all();
+            if ( eof || err || stop ) return;
+        }
+    }
+
+    /* false when the fd is not readable within timeout, or when stopped */
+    bool waitReadable(int timeout, bool &stop) {
+        struct pollfd fds[2] = {{fd_, POLLIN, 0}, {wake_[0], POLLIN, 0}};
+        int n;
+        while ( (n = ::poll(fds, 2, timeout)) < 0 && errno == EINTR ) {}
+        if ( fds[1].revents ) {
+            stop = true;
+            return false;
+        }
+        return n > 0;
+    }
+
+    int                                     fd_;
+    std::size_t                             record_size_;
+    std::size_t                             block_size_;
+    std::vector<std::unique_ptr<char[]>>    buffers_;
+    std::vector<std::size_t>                lengths_;
+
+    /* shared with the reader thread, under mutex_ */
+    std::mutex                              mutex_;
+    std::condition_variable                 cv_;
+    std::size_t                             filled_ = 0;
+    std::size_t                             consumed_ = 0;
+    bool                                    done_ = false;
+    bool                                    stop_ = false;
+    int                                     error_ = 0;
+    int                                     wake_[2];
+    std::thread                             reader_;
+
+    /* the consumer's */
+    bool                                    started_ = false;
+    bool                                    holding_ = false;
+    char const                              *pos_ = nullptr;
+    char const                              *end_ = nullptr;
+    std::string                             carry_;
+    bool                                    from_carry_ = false;
+    std::string_view                        record_;
+    bool                                    ok_ = false;
+};
+
+/*
+ * Records of an FdReader, as std::string_views valid until the iterator
+ * moves. Copies share the reader and its position: a single pass.
+ */
+class LazyIteratorWithFdRecords
+    : public LazyIteratorBase<LazyIteratorWithFdRecords>
+{
+    using self_type = LazyIteratorWithFdRecords;
+public:
+    using value_type = std::string_view;
+
+    LazyIteratorWithFdRecords(int fd, std::size_t record_size,
+                              std::size_t block_size, std::size_t nbuffers)
+        : reader_(std::make_shared<FdReader>(fd, record_size, block_size, nbuffers))
+    {}
+
+    self_type &operator++() {
+        must_ok();
+        reader_->next();
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        self_type res = *this;
+        reader_->next();
+        return res;
+    }
+
+    value_type operator*() {
+        must_ok();
+        return reader_->record();
+    }
+
+    bool ok() {
+        return reader_->ok();
+    }
+private:
+    std::shared_ptr<FdReader>   reader_;
+};
+
+inline auto
+makeLazyIteratorFromFdLines(int fd, std::size_t block_size = 1 << 20, std::size_t nbuffers = 2)
+{
+    return LazyIteratorWithFdRecords(fd, 0, block_size, nbuffers);
+}
+
+inline auto
+makeLazyIteratorFromFdRecords(int fd, std::size_t record_size,
+                              std::size_t block_size = 1 << 20, std::size_t nbuffers = 2)
+{
+    return LazyIteratorWithFdRecords(fd, std::max(record_size, std::size_t(1)),
+            block_size, nbuffers);
+}
+
+/*
+ * The elements of a file written by saveSnapshot(), in place in a read
+ * only mapping: nothing is parsed or copied on open, and processes
+ * mapping the same file share its pages. Copies share the mapping.
+ *
+ * lowerBound(), upperBound(), equalRange() and contains() binary search
+ * the elements left, which must be sorted by compare; the first three
+ * return the matching part as another such iterator.
+ */
+template<class T, class Pointer = T const *>
+class LazyIteratorWithSnapshot
+    : public LazyIteratorRaw<Pointer, LazyIteratorWithSnapshot<T, Pointer>>
+{
+    using self_type = LazyIteratorWithSnapshot;
+    using base_type = LazyIteratorRaw<Pointer, LazyIteratorWithSnapshot<T, Pointer>>;
+public:
+    LazyIteratorWithSnapshot(std::shared_ptr<MappedFile const> file, Pointer beg, Pointer end)
+        : base_type(beg, end)
+        , file_(std::move(file))
+    {}
+
+    /* the mapping is shared, nothing is moved out of this one */
+    auto reverse() {
+        using ReversePointer = std::reverse_iterator<Pointer>;
+        return LazyIteratorWithSnapshot<T, ReversePointer>(
+                file_, ReversePointer(this->end), ReversePointer(this->beg));
+    }
+
+    /* the i-th element left */
+    T at(std::size_t i) {
+        if ( i >= this->remaining() ) {
+            throw std::out_of_range("LazyIteratorWithSnapshot::at");
+        }
+        return this->beg[i];
+    }
+
+    template<class V, class Compare = std::less<>>
+    self_type lowerBound(V const &v, Compare compare = Compare()) {
+        return self_type(file_, std::lower_bound(this->beg, this->end, v, compare), this->end);
+    }
+
+    template<class V, class Compare = std::less<>>
+    self_type upperBound(V const &v, Compare compare = Compare()) {
+        return self_type(file_, std::upper_bound(this->beg, this->end, v, compare), this->end);
+    }
+
+    template<class V, class Compare = std::less<>>
+    self_type equalRange(V const &v, Compare compare = Compare()) {
+        auto range = std::equal_range(this->beg, this->end, v, compare);
+        return self_type(file_, range.first, range.second);
+    }
+
+    template<class V, class Compare = std::less<>>
+    bool contains(V const &v, Compare compare = Compare()) {
+        return std::binary_search(this->beg, this->end, v, compare);
+    }
+private:
+    std::shared_ptr<MappedFile const>   file_;
+};
+
+/* std::system_error when path is not a snapshot of Ts */
+template<class T>
+auto
+makeLazyIteratorFromSnapshot(std::string const &path)
+{
+    static_assert(std::is_trivially_copyable_v<T>, "snapshots of trivially copyable types");
+    /* lookups jump around, no read ahead */
+    auto file = std::make_shared<MappedFile const>(path, MADV_NORMAL);
+    SnapshotHeader header;
+    if ( file->size() >= sizeof(header) ) {
+        std::memcpy(&header, file->data(), sizeof(header));
+    }
+    if ( file->size() < sizeof(header)
+            || std::memcmp(header.magic, SnapshotHeader().magic, 8) != 0
+            || header.element_size != sizeof(T) || header.element_align != alignof(T)
+            || (file->size() - sizeof(header)) / sizeof(T) < header.count ) {
+        throw std::system_error(std::make_error_code(std::errc::invalid_argument),
+                path + ": not a snapshot of this type");
+    }
+    auto beg = reinterpret_cast<T const *>(file->data() + sizeof(header));
+    return LazyIteratorWithSnapshot<T>(std::move(file), beg, beg + header.count);
+}
+
+/* a block read from the file-th path of a LazyIteratorWithFiles */
+struct FileBlock {
+    std::size_t         file = 0;
+    std::uint64_t       offset = 0;
+    std::string_view    data;
+};
+
+/* reads into numbered slots; a slot has one read outstanding at most */
+class BlockReadEngine
+{
+public:
+    virtual void submit(std::size_t slot, int fd, char *buf, std::size_t len, std::uint64_t offset) = 0;
+    /* waits for a completion: its slot, and the bytes read or -errno */
+    virtual std::pair<std::size_t, long> wait() = 0;
+    virtual bool ioUring() const = 0;
+    virtual ~BlockReadEngine() = default;
+};
+
+#if LAZY_HAVE_IO_URING
+/*
+ * io_uring through the raw system calls: reads are queued in the
+ * submission ring and submitted together by the next wait(). The slot
+ * buffers are registered, so that the kernel need not map them for every
+ * read; when that fails (RLIMIT_MEMLOCK), plain reads are used. A ring
+ * whose probe lacks IORING_OP_READ throws, like a failed setup.
+ */
+class IoUringReadEngine
+    : public BlockReadEngine
+{
+public:
+    IoUringReadEngine(std::size_t depth, char *buffers, std::size_t block_size) {
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ring_fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, static_cast<unsigned>(depth), &params));
+        if ( ring_fd_ < 0 ) {
+            throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+        }
+        probe();
+
+        sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        single_mmap_ = params.features & IORING_FEAT_SINGLE_MMAP;
+        if ( single_mmap_ ) {
+            sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        }
+        sq_ring_ = map(sq_size_, IORING_OFF_SQ_RING);
+        cq_ring_ = single_mmap_ ? sq_ring_ : map(cq_size_, IORING_OFF_CQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = static_cast<struct io_uring_sqe *>(map(sqes_size_, IORING_OFF_SQES));
+
+        sq_tail_ = ring<unsigned>(sq_ring_, params.sq_off.tail);
+        sq_mask_ = *ring<unsigned>(sq_ring_, params.sq_off.ring_mask);
+        sq_array_ = ring<unsigned>(sq_ring_, params.sq_off.array);
+        cq_head_ = ring<unsigned>(cq_ring_, params.cq_off.head);
+        cq_tail_ = ring<unsigned>(cq_ring_, params.cq_off.tail);
+        cq_mask_ = *ring<unsigned>(cq_ring_, params.cq_off.ring_mask);
+        cqes_ = ring<struct io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+
+        std::vector<struct iovec> iovs(depth);
+        for ( std::size_t i = 0; i < depth; ++i ) {
+            iovs[i].iov_base = buffers + i * block_size;
+            iovs[i].iov_len = block_size;
+        }
+        fixed_ = read_fixed_ && ::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS,
+                iovs.data(), static_cast<unsigned>(depth)) == 0;
+    }
+
+    ~IoUringReadEngine() override {
+        unmap();
+    }
+
+    void submit(std::size_t slot, int fd, char *buf, std::size_t len, std::uint64_t offset) override {
+        unsigned tail = *sq_tail_,
+                 idx = tail & sq_mask_;
+        auto *sqe = &sqes_[idx];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = fixed_ ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<std::uint64_t>(buf);
+        sqe->len = static_cast<unsigned>(len);
+        sqe->off = offset;
+        sqe->buf_index = static_cast<std::uint16_t>(fixed_ ? slot : 0);
+        sqe->user_data = slot;
+        sq_array_[idx] = idx;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        ++unsubmitted_;
+    }
+
+    std::pair<std::size_t, long> wait() override {
+        if ( unsubmitted_ ) {
+            enter(unsubmitted_, 0, 0);
+        }
+        for ( ;; ) {
+            unsigned head = *cq_head_;
+            if ( head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) ) {
+                auto const &cqe = cqes_[head & cq_mask_];
+                std::pair<std::size_t, long> res(cqe.user_data, cqe.res);
+                __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+                return res;
+            }
+            enter(0, 1, IORING_ENTER_GETEVENTS);
+        }
+    }
+
+    bool ioUring() const override {
+        return true;
+    }
+private:
+    /* without IORING_OP_READ every completion would be -EINVAL */
+    void probe() {
+        constexpr unsigned nops = 256;
+        std::unique_ptr<char[]> buf(new char[sizeof(struct io_uring_probe)
+                + nops * sizeof(struct io_uring_probe_op)]());
+        auto *p = reinterpret_cast<struct io_uring_probe *>(buf.get());
+        auto supported = [p] (unsigned op) {
+            return op <= p->last_op && (p->ops[op].flags & IO_URING_OP_SUPPORTED);
+        };
+        long res = ::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PROBE, p, nops);
+        if ( res < 0 || !supported(IORING_OP_READ) ) {
+            int err = res < 0 ? errno : EOPNOTSUPP;
+            ::close(ring_fd_);
+            throw std::system_error(err, std::generic_category(), "io_uring probe");
+        }
+        read_fixed_ = supported(IORING_OP_READ_FIXED);
+    }
+
+    void *map(std::size_t size, off_t offset) {
+        void *ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring_fd_, offset);
+        if ( ptr == MAP_FAILED ) {
+            int err = errno;
+            unmap();
+            throw std::system_error(err, std::generic_category(), "io_uring mmap");
+        }
+        return ptr;
+    }
+
+    void unmap() {
+        if ( sqes_ ) ::munmap(sqes_, sqes_size_);
+        if ( cq_ring_ && cq_ring_ != sq_ring_ ) ::munmap(cq_ring_, cq_size_);
+        if ( sq_ring_ ) ::munmap(sq_ring_, sq_size_);
+        ::close(ring_fd_);
+    }
+
+    template<class T>
+    static T *ring(void *base, unsigned offset) {
+        return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+    }
+
+    void enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+        for ( ;; ) {
+            long n = ::syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags, nullptr, 0);
+            if ( n >= 0 ) {
+                unsubmitted_ -= std::min<unsigned>(unsubmitted_, static_cast<unsigned>(n));
+                return;
+            }
+            if ( errno != EINTR && errno != EAGAIN && errno != EBUSY ) {
+                throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+            }
+        }
+    }
+
+    int                     ring_fd_ = -1;
+    bool                    single_mmap_ = false;
+    bool                    read_fixed_ = false;
+    bool                    fixed_ = false;
+    std::size_t             sq_size_ = 0, cq_size_ = 0, sqes_size_ = 0;
+    void                    *sq_ring_ = nullptr;
+    void                    *cq_ring_ = nullptr;
+    struct io_uring_sqe     *sqes_ = nullptr;
+    unsigned                *sq_tail_ = nullptr, sq_mask_ = 0, *sq_array_ = nullptr;
+    unsigned                *cq_head_ = nullptr, *cq_tail_ = nullptr, cq_mask_ = 0;
+    struct io_uring_cqe     *cqes_ = nullptr;
+    unsigned                unsubmitted_ = 0;
+};
+#endif
+
+/* pread() on a pool of threads, where io_uring is unavailable */
+class ThreadPoolReadEngine
+    : public BlockReadEngine
+{
+    struct Request {
+        std::size_t     slot;
+        int             fd;
+        char            *buf;
+        std::size_t     len;
+        std::uint64_t   offset;
+    };
+public:
+    explicit ThreadPoolReadEngine(std::size_t nthreads) {
+        for ( std::size_t i = 0; i < std::max(nthreads, std::size_t(1)); ++i ) {
+            threads_.emplace_back([this] () { work(); });
+        }
+    }
+
+    ~ThreadPoolReadEngine() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        requested_.notify_all();
+        for ( auto &t : threads_ ) {
+            t.join();
+        }
+    }
+
+    void submit(std::size_t slot, int fd, char *buf, std::size_t len, std::uint64_t offset) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            requests_.push_back({slot, fd, buf, len, offset});
+        }
+        requested_.notify_one();
+    }
+
+    std::pair<std::size_t, long> wait() override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        completed_cv_.wait(lock, [this] () { return !completed_.empty(); });
+        auto res = completed_.front();
+        completed_.pop_front();
+        return res;
+    }
+
+    bool ioUring() const override {
+        return false;
+    }
+private:
+    void work() {
+        for ( ;; ) {
+            Request req;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                requested_.wait(lock, [this] () { return stop_ || !requests_.empty(); });
+                if ( stop_ ) return;
+                req = requests_.front();
+                requests_.pop_front();
+            }
+            long got = 0;
+            while ( static_cast<std::size_t>(got) < req.len ) {
+                ssize_t n = ::pread(req.fd, req.buf + got, req.len - got, req.offset + got);
+                if ( n < 0 && errno == EINTR ) continue;
+                if ( n < 0 ) {
+                    got = -errno;
+                    break;
+                }
+                if ( n == 0 ) break;
+                got += n;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                completed_.emplace_back(req.slot, got);
+            }
+            completed_cv_.notify_one();
+        }
+    }
+
+    std::vector<std::thread>                        threads_;
+    std::mutex                                      mutex_;
+    std::condition_variable                         requested_;
+    std::condition_variable                         completed_cv_;
+    std::deque<Request>                             requests_;
+    std::deque<std::pair<std::size_t, long>>        completed_;
+    bool                                            stop_ = false;
+};
+
+/*
+ * Keeps queue_depth block reads in flight over a list of files, opening
+ * each file when its first block is queued and closing it after its
+ * last block was consumed. Blocks are handed out in completion order, or
+ * in submission order, that is file by file and offset by offset.
+ */
+class MultiFileReader
+{
+    static constexpr std::size_t npos = std::size_t(-1);
+
+    struct Slot {
+        std::size_t     file = 0;
+        std::uint64_t   offset = 0;
+        std::size_t     seq = 0;
+        long            result = 0;
+        bool            done = false;
+        /* the bytes asked for, and those read so far by short reads */
+        std::size_t     len = 0;
+        std::size_t     got = 0;
+    };
+
+    struct File {
+        int             fd = -1;
+        std::uint64_t   size = 0;
+        std::size_t     outstanding = 0;
+        bool            queued = false;
+    };
+public:
+    MultiFileReader(std::vector<std::string> paths, std::size_t block_size,
+                    std::size_t queue_depth, bool in_order, bool io_uring)
+        : MultiFileReader(std::move(paths), block_size, queue_depth, in_order, nullptr)
+    {
+#if LAZY_HAVE_IO_URING
+        if ( io_uring ) {
+            try {
+                engine_ = std::make_unique<IoUringReadEngine>(depth_, buffers_.get(), block_size_);
+            } catch ( std::system_error const & ) {
+            }
+        }
+#endif
+        if ( !engine_ ) {
+            engine_ = std::make_unique<ThreadPoolReadEngine>(std::min<std::size_t>(depth_, 16));
+        }
+    }
+
+    /* reads through engine, which may return fewer bytes than asked for */
+    MultiFileReader(std::vector<std::string> paths, std::size_t block_size,
+                    std::size_t queue_depth, bool in_order, std::unique_ptr<BlockReadEngine> engine)
+        : paths_(std::move(paths))
+        , files_(paths_.size())
+        , block_size_(std::min<std::size_t>(std::max<std::size_t>(block_size, 4096), 1 << 30))
+        , depth_(std::max<std::size_t>(queue_depth, 1))
+        , in_order_(in_order)
+        , slots_(depth_)
+        , by_seq_(depth_)
+        , buffers_(static_cast<char *>(std::aligned_alloc(4096, depth_ * block_size_)), &std::free)
+        , engine_(std::move(engine))
+    {
+        if ( !buffers_ ) {
+            throw std::bad_alloc();
+        }
+        for ( std::size_t i = depth_; i-- > 0; ) {
+            free_.push_back(i);
+        }
+    }
+
+    MultiFileReader(MultiFileReader const &) = delete;
+    MultiFileReader &operator=(MultiFileReader const &) = delete;
+
+    /* the kernel may still write into the buffers */
+    ~MultiFileReader() {
+        while ( in_flight_ > 0 ) {
+            complete(engine_->wait());
+        }
+        for ( auto &f : files_ ) {
+            if ( f.fd >= 0 ) ::close(f.fd);
+        }
+    }
+
+    bool ok() {
+        started();
+        return current_ != npos;
+    }
+
+    FileBlock block() {
+        started();
+        auto const &slot = slots_[current_];
+        return {slot.file, slot.offset,
+                std::string_view(buffer(current_), static_cast<std::size_t>(slot.result))};
+    }
+
+    void next() {
+        started();
+        seek();
+    }
+
+    bool ioUring() const {
+        return engine_->ioUring();
+    }
+private:
+    void started() {
+        if ( !started_ ) {
+            started_ = true;
+            seek();
+        }
+    }
+
+    void seek() {
+        if ( current_ != npos ) {
+            release(current_);
+            current_ = npos;
+        }
+        queue();
+        if ( free_.size() == depth_ ) {
+            return;
+        }
+        std::size_t slot;
+        if ( in_order_ ) {
+            slot = by_seq_[delivered_ % depth_];
+            while ( !slots_[slot].done ) {
+                complete(engine_->wait());
+            }
+            ++delivered_;
+        } else {
+            do {
+                slot = complete(engine_->wait());
+            } while ( slot == npos );
+        }
+        if ( slots_[slot].result < 0 ) {
+            throw std::system_error(static_cast<int>(-slots_[slot].result), std::generic_category(),
+                    paths_[slots_[slot].file]);
+        }
+        current_ = slot;
+    }
+
+    /* as many reads as there are free slots */
+    void queue() {
+        while ( !free_.empty() && next_file_ < files_.size() ) {
+            auto &f = files_[next_file_];
+            if ( !f.queued && f.fd < 0 ) {
+                open(next_file_);
+                if ( f.size == 0 ) {
+                    ::close(f.fd);
+                    f.fd = -1;
+                    f.queued = true;
+                    ++next_file_;
+                    continue;
+                }
+            }
+            auto slot = free_.back();
+            free_.pop_back();
+            auto len = static_cast<std::size_t>(std::min<std::uint64_t>(block_size_, f.size - next_offset_));
+            slots_[slot] = {next_file_, next_offset_, queued_, 0, false, len, 0};
+            by_seq_[queued_ % depth_] = slot;
+            ++queued_;
+            ++f.outstanding;
+            ++in_flight_;
+            engine_->submit(slot, f.fd, buffer(slot), len, next_offset_);
+
+            next_offset_ += len;
+            if ( next_offset_ == f.size ) {
+                f.queued = true;
+                ++next_file_;
+                next_offset_ = 0;
+            }
+        }
+    }
+
+    void open(std::size_t i) {
+        auto &f = files_[i];
+        f.fd = ::open(paths_[i].c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if ( f.fd < 0 || ::fstat(f.fd, &st) < 0 ) {
+            throw std::system_error(errno, std::generic_category(), paths_[i]);
+        }
+        f.size = static_cast<std::uint64_t>(st.st_size);
+    }
+
+    /* a short read is followed by one for the rest, as the pread() pool
+     * does: npos until the slot has all of its bytes, an error or EOF
+     */
+    std::size_t complete(std::pair<std::size_t, long> res) {
+        auto &slot = slots_[res.first];
+        if ( res.second > 0 && slot.got + res.second < slot.len ) {
+            slot.got += res.second;
+            engine_->submit(res.first, files_[slot.file].fd, buffer(res.first) + slot.got,
+                    slot.len - slot.got, slot.offset + slot.got);
+            return npos;
+        }
+        --in_flight_;
+        slot.result = res.second < 0 ? res.second : static_cast<long>(slot.got) + res.second;
+        slot.done = true;
+        return res.first;
+    }
+
+    void release(std::size_t slot) {
+        auto &f = files_[slots_[slot].file];
+        if ( --f.outstanding == 0 && f.queued ) {
+            ::close(f.fd);
+            f.fd = -1;
+        }
+        free_.push_back(slot);
+    }
+
+    char *buffer(std::size_t slot) {
+        return buffers_.get() + slot * block_size_;
+    }
+
+    std::vector<std::string>                    paths_;
+    std::vector<File>                           files_;
+    std::size_t                                 block_size_;
+    std::size_t                                 depth_;
+    bool                                        in_order_;
+    std::vector<Slot>                           slots_;
+    /* the slot of sequence number seq, at seq % depth_ */
+    std::vector<std::size_t>                    by_seq_;
+    std::vector<std::size_t>                    free_;
+    std::unique_ptr<char, decltype(&std::free)> buffers_;
+    std::unique_ptr<BlockReadEngine>            engine_;
+
+    bool                                        started_ = false;
+    std::size_t                                 current_ = npos;
+    std::size_t                                 next_file_ = 0;
+    std::uint64_t                               next_offset_ = 0;
+    std::size_t                                 queued_ = 0;
+    std::size_t                                 delivered_ = 0;
+    std::size_t                                 in_flight_ = 0;
+};
+
+/*
+ * FileBlocks of a MultiFileReader, whose data is valid until the
+ * iterator moves. Copies share the reader and its position: a single pass.
+ */
+class LazyIteratorWithFiles
+    : public LazyIteratorBase<LazyIteratorWithFiles>
+{
+    using self_type = LazyIteratorWithFiles;
+public:
+    using value_type = FileBlock;
+
+    LazyIteratorWithFiles(std::vector<std::string> paths, std::size_t block_size,
+                          std::size_t queue_depth, bool in_order, bool io_uring)
+        : reader_(std::make_shared<MultiFileReader>(std::move(paths), block_size,
+                                                    queue_depth, in_order, io_uring))
+    {}
+
+    explicit LazyIteratorWithFiles(std::shared_ptr<MultiFileReader> reader)
+        : reader_(std::move(reader))
+    {}
+
+    self_type &operator++() {
+        must_ok();
+        reader_->next();
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        self_type res = *this;
+        reader_->next();
+        return res;
+    }
+
+    value_type operator*() {
+        must_ok();
+        return reader_->block();
+    }
+
+    bool ok() {
+        return reader_->ok();
+    }
+
+    /* false when reading with the pread() thread pool */
+    bool ioUring() const {
+        return reader_->ioUring();
+    }
+private:
+    std::shared_ptr<MultiFileReader>    reader_;
+};
+
+/*
+ * The lines of FileBlocks given file by file and in order, as
+ * std::string_views valid until the iterator moves. A line straddling
+ * blocks is copied; a file ends its last line.
+ */
+template<class Iterator>
+class LazyIteratorWithBlockLines
+    : public LazyIteratorBase<LazyIteratorWithBlockLines<Iterator>>
+{
+    using self_type = LazyIteratorWithBlockLines;
+public:
+    using value_type = std::string_view;
+
+    explicit LazyIteratorWithBlockLines(Iterator iter)
+        : internal_iter_(iter)
+    {}
+
+    self_type &operator++() {
+        must_ok();
+        seek();
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        self_type res = *this;
+        seek();
+        return res;
+    }
+
+    value_type operator*() {
+        must_ok();
+        return line_;
+    }
+
+    bool ok() {
+        if ( !started_ ) {
+            started_ = true;
+            seek();
+        }
+        return ok_;
+    }
+private:
+    void seek() {
+        if ( from_carry_ ) {
+            carry_.clear();
+            from_carry_ = false;
+        }
+        for ( ;; ) {
+            if ( pos_ == end_ ) {
+                /* the block of the last line is let go only now */
+                if ( holding_ ) {
+                    holding_ = false;
+                    ++internal_iter_;
+                }
+                bool more = internal_iter_.ok();
+                FileBlock block;
+                if ( more ) {
+                    block = *internal_iter_;
+                    pos_ = block.data.data();
+                    end_ = pos_ + block.data.size();
+                    holding_ = true;
+                }
+                if ( !carry_.empty() && (!more || block.file != file_) ) {
+                    file_ = block.file;
+                    line_ = carry_;
+                    from_carry_ = true;
+                    ok_ = true;
+                    return;
+                }
+                if ( !more ) {
+                    ok_ = false;
+                    return;
+                }
+                file_ = block.file;
+                continue;
+            }
+            char const *nl = kernel_find_byte(pos_, end_, '\n');
+            bool whole = nl != end_;
+            if ( whole && carry_.empty() ) {
+                line_ = std::string_view(pos_, nl - pos_);
+            } else {
+                carry_.append(pos_, nl);
+                line_ = carry_;
+                from_carry_ = true;
+            }
+            pos_ = whole ? nl + 1 : end_;
+            if ( whole ) {
+                ok_ = true;
+                return;
+            }
+        }
+    }
+
+    Iterator            internal_iter_;
+    bool                started_ = false;
+    bool                holding_ = false;
+    char const          *pos_ = nullptr;
+    char const          *end_ = nullptr;
+    std::size_t         file_ = 0;
+    std::string         carry_;
+    bool                from_carry_ = false;
+    std::string_view    line_;
+    bool                ok_ = false;
+};
+
+/* io_uring: false forces the pread() thread pool */
+inline auto
+makeLazyIteratorFromFiles(std::vector<std::string> paths, std::size_t block_size = 1 << 20,
+                          std::size_t queue_depth = 16, bool in_order = true, bool io_uring = true)
+{
+    return LazyIteratorWithFiles(std::move(paths), block_size, queue_depth, in_order, io_uring);
+}
+
+inline auto
+makeLazyIteratorFromFilesLines(std::vector<std::string> paths, std::size_t block_size = 1 << 20,
+                               std::size_t queue_depth = 16, bool io_uring = true)
+{
+    return LazyIteratorWithBlockLines<LazyIteratorWithFiles>(
+            makeLazyIteratorFromFiles(std::move(paths), block_size, queue_depth, true, io_uring));
+}
+
+#endif /* _LAZYFILE_HH_ */
@@ -1,4 +1,7 @@
 #include "LazyIterator.hh"
+#include "LazyFile.hh"
+#include "LazyWriter.hh"
+#include "LazyColumns.hh"
 #include "testings.hh"
 
 #include <iostream>
@@ -8,11 +11,20 @@
 #include <type_traits>
 #include <numeric>
 #include <exception>
+#include <stdexcept>
+#include <cstddef>
 #include <utility>
 #include <cstdlib>
 #include <algorithm>
 #include <functional>
 #include <limits>
+#include <cmath>
+#include <fstream>
+#include <charconv>
+#include <cstdio>
+#include <thread>
+#include <deque>
+#include <memory>
 
 struct StupidGen {
     int now = 0;
@@ -43,6 +55,1321 @@ struct StupidConjecture {
 
 auto printer = [] (const auto &e) { std::cout << e << "\n"; };
 
+void test32() {
+    std::size_t n = 1 << 20;
+    auto small = makeLazyIteratorFromIndex([] (std::size_t i) { return static_cast<int>(i * 2654435761u % 100) - 50; }, n)
+        .done();
+    {
+        TimeInterval _("Compress 7 bit values", n);
+        auto packed = small.dup().doneCompressed();
+        std::cout << "Bytes: " << packed.encodedBytes() << " vs " << n * sizeof(int)
+            << ", Sum: " << packed.dup().sum() << " vs " << small.dup().sum()
+            << ", Min: " << packed.dup().numeric_min() << ", Max: " << packed.dup().numeric_max() << "\n";
+    }
+    {
+        TimeInterval _("Decode them", n);
+        std::size_t same = 0;
+        makeLazyIteratorFromZip(small.dup().doneCompressed(1000), small.dup())
+            .foreach([&same] (auto const &e) { same += e.first == e.second; });
+        std::cout << "Same: " << (same == n) << "\n";
+    }
+    {
+        /* from the middle of a block */
+        auto packed = small.dup().doneCompressed(1000);
+        auto rest = small.dup();
+        packed.advance(12345);
+        rest.advance(12345);
+        ++packed;
+        ++rest;
+        std::cout << "Rest: " << packed.remaining() << ", Next: " << *packed << " vs " << *rest
+            << ", Sum: " << packed.dup().sum() << " vs " << rest.dup().sum() << "\n";
+    }
+
+    std::vector<std::string> levels = {"debug", "info", "warning", "error"};
+    auto logs = makeLazyIteratorFromIndex([&levels] (std::size_t i) { return levels[i % 100000 == 0 ? 3 : i / 5000 % 3]; }, n)
+        .done();
+    {
+        TimeInterval _("Compress repeated strings", n);
+        auto packed = logs.dup().doneCompressed();
+        auto groups = packed.dup().groupSame();
+        std::cout << "Bytes: " << packed.encodedBytes() << ", Groups: " << groups.dup().count()
+            << " vs " << logs.dup().groupSame().count() << ", First: ";
+        groups.take(3).foreach([] (auto const &g) { std::cout << g << " "; });
+        std::cout << "\n";
+    }
+    {
+        auto runs = makeLazyIteratorFromIndex([] (std::size_t i) { return static_cast<long>(i / 777) * 1000000007L; }, n);
+        auto packed = runs.dup().doneCompressed();
+        std::cout << "Runs, bytes: " << packed.encodedBytes() << ", Sum: " << packed.dup().sum()
+            << " vs " << runs.dup().sum() << ", Groups: " << packed.groupSame().count() << "\n";
+    }
+}
+
+void test31() {
+    std::string path = "/tmp/lazy_iterator_test31.snap";
+    std::size_t n = 1 << 20;
+    auto squares = makeLazyIteratorFromIndex([] (std::size_t i) { return static_cast<long>(i * i % 1000003); }, n)
+        .done()
+        .sort();
+    {
+        TimeInterval _("Save a snapshot", n);
+        std::cout << "Saved: " << squares.saveSnapshot(path) << "\n";
+    }
+    {
+        TimeInterval _("Reopen it, a lookup", 1);
+        auto snap = makeLazyIteratorFromSnapshot<long>(path);
+        std::cout << "Elements: " << snap.remaining() << ", Min: " << snap.at(0)
+            << ", Contains 4: " << snap.contains(4L) << ", Contains 5: " << snap.contains(5L) << "\n";
+        /* it++ keeps the mapping alive past the temporary it copies */
+        auto before = makeLazyIteratorFromSnapshot<long>(path)++;
+        std::cout << "Post increment: " << *before << ", " << before.remaining() << "\n";
+    }
+    {
+        TimeInterval _("Equal ranges and bounds", 1);
+        auto snap = makeLazyIteratorFromSnapshot<long>(path);
+        std::cout << "Equal to 9: " << snap.equalRange(9L).count()
+            << ", At least 1000000: " << snap.lowerBound(1000000L).count()
+            << ", Above 1000000: " << snap.upperBound(1000000L).count() << ", Largest: ";
+        snap.reverse().take(3).foreach([] (long x) { std::cout << x << " "; });
+        std::cout << "\n";
+    }
+    {
+        TimeInterval _("Sum from the mapping", n);
+        std::cout << "Same: " << (makeLazyIteratorFromSnapshot<long>(path).sum() == squares.dup().sum()) << "\n";
+    }
+    {
+        /* the order of iteration is what is saved */
+        squares.dup().reverse().saveSnapshot(path);
+        auto snap = makeLazyIteratorFromSnapshot<long>(path);
+        std::cout << "Descending: " << snap.at(0) << ", " << snap.equalRange(9L, std::greater<>()).count() << "\n";
+        try {
+            makeLazyIteratorFromSnapshot<int>(path);
+        } catch ( std::system_error const &e ) {
+            std::cout << "should throw: " << e.what() << "\n";
+        }
+    }
+    std::remove(path.c_str());
+}
+
+void test30() {
+    std::string path = "/tmp/lazy_iterator_test30.col";
+    std::vector<std::string> cities = {"Paris", "Lyon", "Nantes", "Lille", "Nice"};
+    std::size_t n = 1 << 20;
+    auto rows = makeLazyIteratorFromIndex([&cities] (std::size_t i) {
+                return std::make_tuple(static_cast<long>(i) * 1000 - 7, /* sorted, delta encoded */
+                                       static_cast<int>(i * 2654435761u % 100), /* 7 bits */
+                                       cities[i * i % cities.size()],
+                                       i * 0.25);
+            }, n);
+    using Row = decltype(rows)::value_type;
+
+    {
+        TimeInterval _("Write a column file", n);
+        std::cout << "Rows: " << rows.dup().writeColumns(path, 1 << 14) << ", Bytes: ";
+        std::ifstream in(path, std::ios::ate | std::ios::binary);
+        std::cout << in.tellg() << " vs " << n * (8 + 4 + 8 + 8) << "\n";
+    }
+    {
+        TimeInterval _("Read it all back", n);
+        std::size_t same = 0;
+        makeLazyIteratorFromZip(makeLazyIteratorFromColumnFile<Row>(path), rows.dup())
+            .foreach([&same] (auto const &e) { same += e.first == e.second; });
+        std::cout << "Same: " << (same == n) << "\n";
+    }
+    {
+        TimeInterval _("Blocks skipped by stats, one column decoded", n);
+        long lo = 700000000, hi = 700100000;
+        auto picked = makeLazyIteratorFromColumnFile<Row>(path)
+            .filterBlocks([lo, hi] (ColumnStats<Row> const &s) { return s.max<0>() >= lo && s.min<0>() < hi; })
+            .project<0>();
+        std::cout << "Candidates: " << picked.dup().count() << ", Matches: "
+            << picked.filter([lo, hi] (long x) { return x >= lo && x < hi; }).count() << "\n";
+    }
+    {
+        TimeInterval _("Two columns", n);
+        makeLazyIteratorFromColumnFile<Row>(path)
+            .project<2, 1>()
+            .take(4)
+            .foreach([] (auto const &e) { std::cout << std::get<0>(e) << ":" << std::get<1>(e) << " "; });
+        std::cout << "\n";
+    }
+    {
+        std::vector<std::pair<std::string, int>> words = {{"b", -3}, {"a", 1 << 30}, {"b", 7}};
+        makeLazyIterator(words.begin(), words.end()).done().writeColumns(path);
+        makeLazyIteratorFromColumnFile<std::pair<std::string_view, int>>(path)
+            .foreach([] (auto const &e) { std::cout << e.first << "=" << e.second << " "; });
+        std::cout << "\n";
+        try {
+            makeLazyIteratorFromColumnFile<std::pair<std::string, long>>(path);
+        } catch ( std::system_error const &e ) {
+            std::cout << "should throw: " << e.what() << "\n";
+        }
+    }
+    {
+        /* unwinding leaves the last complete file as it was */
+        try {
+            rows.dup().map([] (Row const &r) {
+                    if ( std::get<0>(r) > 5000 ) throw std::runtime_error("halfway");
+                    return r;
+                }).writeColumns(path);
+        } catch ( std::runtime_error const & ) {
+        }
+        std::cout << "Kept after a throw: "
+            << makeLazyIteratorFromColumnFile<std::pair<std::string_view, int>>(path).count() << "\n";
+
+        /* a dictionary larger than its chunk, in the footer of the one block */
+        std::uint64_t footer, ndict = 1000;
+        std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+        f.seekg(-16, std::ios::end);
+        f.read(reinterpret_cast<char *>(&footer), 8);
+        f.seekp(footer + sizeof(ColumnFileHeader) + 8 + 8 + offsetof(ColumnChunk, first));
+        f.write(reinterpret_cast<char const *>(&ndict), 8);
+        f.close();
+        try {
+            makeLazyIteratorFromColumnFile<std::pair<std::string_view, int>>(path);
+        } catch ( std::system_error const &e ) {
+            std::cout << "should throw: " << e.what() << "\n";
+        }
+    }
+    {
+        /* a block with a NaN is kept whatever its other values */
+        double nan = std::numeric_limits<double>::quiet_NaN();
+        std::vector<double> xs = {1, 2, 3, 4, nan, 6, 7, 8, 9, 10, 11, 12};
+        makeLazyIterator(xs.begin(), xs.end()).writeColumns(path, 4);
+        auto kept = makeLazyIteratorFromColumnFile<double>(path)
+                        .filterBlocks([] (ColumnStats<double> const &s) { return s.max<0>() >= 6.5 && s.min<0>() < 7.5; });
+        std::cout << "With a NaN, candidates: " << kept.dup().count() << ", matches: "
+            << kept.filter([] (double x) { return x >= 6.5 && x < 7.5; }).count() << "\n";
+    }
+    std::remove(path.c_str());
+}
+
+void test29() {
+    std::size_t n = 1 << 20;
+    std::string path = "/tmp/lazy_iterator_test29.txt";
+    auto slurp = [&path] () {
+        std::ifstream in(path);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    };
+
+    std::string expected;
+    {
+        TimeInterval _("Integers through std::ofstream", n);
+        std::ofstream out(path);
+        makeLazyIteratorFromIota(0L, static_cast<long>(n), 1)
+            .map([] (long x) { return x * x - 1000; })
+            .foreach([&out] (long x) { out << x << "\n"; });
+        out.close();
+        expected = slurp();
+    }
+    for ( bool background : {false, true} ) {
+        TimeInterval _(background ? "Integers through writeTo(), in the background"
+                                  : "Integers through writeTo()", n);
+        auto records = makeLazyIteratorFromIota(0L, static_cast<long>(n), 1)
+            .map([] (long x) { return x * x - 1000; })
+            .writeTo(path, LazyFormat(), background);
+        std::cout << "Records: " << records << ", Same: " << (slurp() == expected) << "\n";
+    }
+    {
+        TimeInterval _("Doubles through writeTo()", n);
+        makeLazyIteratorFromUniform(n, 3).writeTo(path);
+        std::size_t same = 0;
+        auto text = slurp();
+        makeLazyIteratorFromZip(
+                makeLazyIteratorFromSplit(std::string_view(text).substr(0, text.size() - 1), '\n'),
+                makeLazyIteratorFromUniform(n, 3))
+            .foreach([&same] (auto const &e) { same += std::stod(std::string(e.first)) == e.second; });
+        std::cout << "Round trips: " << same << "\n";
+    }
+    {
+        std::vector<std::string> words = {"lazy", "iterator", "moon"};
+        makeLazyIteratorFromIndex([&words] (std::size_t i) { return words[i * i % 7 % 3]; }, 12)
+            .done()
+            .sort()
+            .groupSame()
+            .writeTo(path);
+        std::cout << slurp();
+        makeLazyIteratorFromIndex([] (std::size_t i) { return std::make_pair(i, i * 0.5); }, 3)
+            .writeTo(path, [] (BufferedWriter &w, auto const &e) {
+                    w.append("x=");
+                    lazyFormat(w, e);
+                });
+        std::cout << slurp();
+    }
+    {
+        /* records larger than the buffer go out with it in a writev() */
+        std::string big(3 << 20, 'z');
+        makeLazyIteratorFromIndex([&big] (std::size_t i) { return std::string_view(big).substr(0, i << 20); }, 4)
+            .writeTo(path);
+        std::cout << "Bytes: " << slurp().size() << "\n";
+    }
+    std::remove(path.c_str());
+}
+
+void test28() {
+    using namespace lazy_placeholders;
+    long n = 1L << 40;
+    {
+        TimeInterval _("Closed forms over a range of 2^40", 1);
+        std::cout << "Count: " << makeLazyIteratorFromIota(0L, n, 3).count()
+            << ", Sum: " << makeLazyIteratorFromIota(0L, n, 3).take(1000000).sum()
+            << ", Min: " << makeLazyIteratorFromIota(n, -n, -7).numeric_min()
+            << ", Max: " << makeLazyIteratorFromIota(n, -n, -7).numeric_max() << "\n";
+    }
+    {
+        TimeInterval _("Multiples of 7 with a remainder of 3 mod 5", 1);
+        auto picked = makeLazyIteratorFromIota(0L, n, 7).filter(_1 % 5 == 3);
+        std::cout << "Count: " << picked.remaining() << ", First: ";
+        picked.take(4).foreach([] (long x) { std::cout << x << " "; });
+        std::cout << "\n";
+    }
+    {
+        std::size_t m = 1 << 22;
+        std::size_t loop = 0, stepped = 0;
+        {
+            TimeInterval _("Filter _1 % 10 == 0, one by one", m);
+            loop = makeLazyIteratorFromGenerator(StupidGen(), m)
+                .filter(_1 % 10 == 0)
+                .count();
+        }
+        {
+            TimeInterval _("Filter _1 % 10 == 0, stepped", m);
+            stepped = makeLazyIteratorFromIota(0, static_cast<int>(m), 1)
+                .filter(_1 % 10 == 0)
+                .count();
+        }
+        std::cout << "Count: " << stepped << ", Same: " << (loop == stepped) << "\n";
+    }
+    {
+        /* the operands of % and == convert like in the predicate: int % 3u
+         * and unsigned % -3 compute in unsigned
+         */
+        auto same = [] (auto iota, auto pred) {
+            std::size_t expected = 0;
+            for ( auto it = iota; it.ok(); ++it ) expected += pred(*it);
+            return iota.filter(pred).count() == expected;
+        };
+        std::cout << "Mixed signedness, same: "
+            << same(makeLazyIteratorFromIota(-100, 100, 1), _1 % 3u == 0)
+            << same(makeLazyIteratorFromIota(-100, 100, 1), _1 % 3 == 2u)
+            << same(makeLazyIteratorFromIota(0u, 4000000000u, 7), _1 % -3 == 0)
+            << same(makeLazyIteratorFromIota(4294967200u, 4294967295u, 1), _1 % -3 == -5)
+            << same(makeLazyIteratorFromIota(0ul, 1000ul, 3), _1 % 10 == -1)
+            << same(makeLazyIteratorFromIota(static_cast<unsigned short>(0), static_cast<unsigned short>(60000), 11),
+                    _1 % 7 == 3) << "\n";
+    }
+}
+
+void test27() {
+    /* known answer of Random123 for a zero counter and key */
+    auto kat = Philox4x32(0)(0);
+    std::cout << std::hex << kat[0] << " " << kat[1] << " " << kat[2] << " " << kat[3] << std::dec
+        << ", Same: " << (kat == Philox4x32::result_type{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8})
+        << "\n";
+
+    std::size_t n = 1 << 22;
+    {
+        TimeInterval _("Squares by index, skipped and taken", n);
+        auto squares = makeLazyIteratorFromIndex([] (std::size_t i) { return i * i; }, n);
+        squares.advance(n - 10);
+        std::cout << "Last: " << squares.take(3).sum() << ", Left: " << squares.remaining() << "\n";
+    }
+    {
+        TimeInterval _("Uniforms, mean and variance", n);
+        std::cout << makeLazyIteratorFromUniform(n, 42).meanVariance() << "\n";
+    }
+    {
+        TimeInterval _("Uniforms, in parallel", n);
+        auto stats = makeLazyIteratorFromUniform(n, 42).parallelAggregate(sumOf(), minOf(), maxOf());
+        std::cout << "Sum: " << std::get<0>(stats) << ", Min: " << std::get<1>(stats)
+            << ", Max: " << std::get<2>(stats) << "\n";
+    }
+    {
+        /* each part computes its own numbers, same as one pass */
+        auto parts = parallelSplits(makeLazyIteratorFromIndex(PhiloxBits{Philox4x32(7)}, 1 << 20),
+                [] (auto part) { return part.reduce([] (std::uint64_t a, std::uint64_t b) { return a ^ b; },
+                                                    std::uint64_t(0)); });
+        std::uint64_t whole = 0, split = 0;
+        makeLazyIteratorFromIndex(PhiloxBits{Philox4x32(7)}, 1 << 20)
+            .foreach([&] (std::uint64_t x) { whole ^= x; });
+        for ( auto x : parts ) split ^= x;
+        std::cout << "Parts: " << parts.size() << ", Same: " << (whole == split) << "\n";
+    }
+}
+
+void test26() {
+    std::vector<std::string> words = {"lazy", "iterator", "moon", "milky-way", "a", "hello", "world"};
+    std::string text;
+    std::size_t n = 1 << 20;
+    for ( std::size_t i = 0; i < n; ++i ) {
+        text += words[std::rand() % words.size()];
+        text += i % 11 == 10 ? "\n" : (i % 3 ? " " : ",  ");
+    }
+
+    {
+        TimeInterval _("Split into std::strings first", n);
+        std::vector<std::string> tokens;
+        std::size_t beg = 0;
+        for ( std::size_t end; (end = text.find(' ', beg)) != std::string::npos; beg = end + 1 ) {
+            tokens.push_back(text.substr(beg, end - beg));
+        }
+        tokens.push_back(text.substr(beg));
+        std::cout << "Tokens: " << tokens.size() << "\n";
+    }
+    {
+        TimeInterval _("Split by a char", n);
+        std::size_t tokens = 0;
+        makeLazyIteratorFromSplit(text, ' ').foreach([&] (std::string_view) { ++tokens; });
+        std::cout << "Tokens: " << tokens << ", count(): " << makeLazyIteratorFromSplit(text, ' ').count() << "\n";
+    }
+    {
+        TimeInterval _("Word count, split by a char set", n);
+        makeLazyIteratorFromSplit(text, splitAnyOf(" ,\n"))
+            .filter([] (std::string_view w) { return !w.empty(); })
+            .done()
+            .sort()
+            .groupSame()
+            .foreach([] (auto const &wc) { std::cout << wc.t << ":" << wc.count << " "; });
+        std::cout << "\n";
+    }
+    {
+        TimeInterval _("Split by a string", n);
+        std::cout << "Lines: " << makeLazyIteratorFromSplit(text, ",  ").count() << ", ";
+        makeLazyIteratorFromSplit("a::b:::c::", "::")
+            .foreach([] (std::string_view t) { std::cout << "[" << t << "]"; });
+        std::cout << "\n";
+    }
+}
+
+/* pread() of at most half what is asked for, as io_uring may do */
+struct ShortReadEngine
+    : public BlockReadEngine
+{
+    void submit(std::size_t slot, int fd, char *buf, std::size_t len, std::uint64_t offset) override {
+        auto n = ::pread(fd, buf, std::max<std::size_t>(len / 2, 1), static_cast<off_t>(offset));
+        done.push_back({slot, n < 0 ? -errno : n});
+    }
+
+    std::pair<std::size_t, long> wait() override {
+        auto res = done.front();
+        done.pop_front();
+        return res;
+    }
+
+    bool ioUring() const override {
+        return false;
+    }
+
+    std::deque<std::pair<std::size_t, long>> done;
+};
+
+void test25() {
+    /* files of uneven sizes, some empty, some without a final newline */
+    std::vector<std::string> paths;
+    std::size_t lines = 0, bytes = 0;
+    for ( std::size_t f = 0; f < 40; ++f ) {
+        std::string path = "/tmp/lazy_iterator_test25_" + std::to_string(f) + ".txt",
+                    text;
+        std::size_t n = f % 9 == 0 ? 0 : std::rand() % 20000;
+        for ( std::size_t i = 0; i < n; ++i ) {
+            text += std::to_string(std::rand() % 100000) + (i % 5 ? "" : " with a tail") + "\n";
+        }
+        if ( f % 4 == 1 ) {
+            text += "unterminated";
+        }
+        lines += n + (f % 4 == 1);
+        bytes += text.size();
+        std::ofstream(path) << text;
+        paths.push_back(path);
+    }
+
+    for ( bool io_uring : {true, false} ) {
+        {
+            auto files = makeLazyIteratorFromFiles(paths, 1 << 16, 32, false, io_uring);
+            std::cout << (files.ioUring() ? "io_uring" : "pread pool") << "\n";
+            TimeInterval _("Blocks of many files, as completed", bytes);
+            std::size_t got = 0;
+            files.foreach([&] (FileBlock const &block) { got += block.data.size(); });
+            std::cout << "Bytes: " << got << ", Same: " << (got == bytes) << "\n";
+        }
+        {
+            TimeInterval _("Lines of many files", lines);
+            std::size_t got = 0, chars = 0;
+            /* small blocks, many lines straddle two of them */
+            makeLazyIteratorFromFilesLines(paths, 4096, 8, io_uring)
+                .foreach([&] (std::string_view line) { ++got; chars += line.size(); });
+            std::cout << "Lines: " << got << ", Same: " << (got == lines) << "\n";
+        }
+    }
+    for ( bool in_order : {true, false} ) {
+        /* short reads are completed, not delivered as short blocks */
+        std::size_t got = 0;
+        LazyIteratorWithFiles(std::make_shared<MultiFileReader>(paths, 4096, 8, in_order,
+                                                                std::make_unique<ShortReadEngine>()))
+            .foreach([&] (FileBlock const &block) { got += block.data.size(); });
+        std::cout << "Short reads, bytes: " << got << ", Same: " << (got == bytes) << "\n";
+    }
+    {
+        auto got = LazyIteratorWithBlockLines<LazyIteratorWithFiles>(
+                LazyIteratorWithFiles(std::make_shared<MultiFileReader>(paths, 4096, 8, true,
+                                                                        std::make_unique<ShortReadEngine>())))
+            .count();
+        std::cout << "Short reads, lines: " << got << ", Same: " << (got == lines) << "\n";
+    }
+    {
+        /* an early stop leaves reads in flight */
+        auto first = makeLazyIteratorFromFilesLines(paths, 4096, 16).take(3).count();
+        std::cout << "First lines: " << first << "\n";
+    }
+    for ( auto const &path : paths ) {
+        std::remove(path.c_str());
+    }
+}
+
+void test24() {
+    std::size_t n = 1 << 20;
+    std::string text;
+    for ( std::size_t i = 0; i < n; ++i ) {
+        text += std::to_string(i * 2654435761u % 1000003) + (i % 7 ? "" : " and a longer tail") + "\n";
+    }
+
+    /* a writer on the other end of a pipe, in uneven chunks */
+    int fds[2];
+    if ( ::pipe(fds) < 0 ) return;
+    std::thread writer([&] () {
+        for ( std::size_t off = 0; off < text.size(); ) {
+            auto len = std::min<std::size_t>(text.size() - off, 1000 + std::rand() % 60000);
+            auto wrote = ::write(fds[1], text.data() + off, len);
+            if ( wrote <= 0 ) break;
+            off += wrote;
+        }
+        ::close(fds[1]);
+    });
+    {
+        TimeInterval _("Lines from a pipe", n);
+        std::size_t lines = 0, chars = 0;
+        /* small blocks, many lines straddle two of them */
+        makeLazyIteratorFromFdLines(fds[0], 4096, 3)
+            .foreach([&] (std::string_view line) { ++lines; chars += line.size() + 1; });
+        std::cout << "Lines: " << lines << ", Same: " << (chars == text.size()) << "\n";
+    }
+    writer.join();
+    ::close(fds[0]);
+
+    std::string path = "/tmp/lazy_iterator_test24.txt";
+    std::ofstream(path) << text;
+    {
+        TimeInterval _("Lines from a file descriptor", n);
+        int fd = ::open(path.c_str(), O_RDONLY);
+        std::cout << "Longer tails: "
+            << makeLazyIteratorFromFdLines(fd)
+                .filter([] (std::string_view line) { return line.size() > 10; })
+                .count()
+            << "\n";
+        ::close(fd);
+    }
+    {
+        /* 7 bytes records over 4096 bytes blocks */
+        int fd = ::open(path.c_str(), O_RDONLY);
+        auto records = makeLazyIteratorFromFdRecords(fd, 7, 4096).count();
+        std::cout << "Records: " << records << ", Same: "
+            << (records == (text.size() + 6) / 7) << "\n";
+        ::close(fd);
+    }
+    std::remove(path.c_str());
+}
+
+void test23() {
+    std::string path = "/tmp/lazy_iterator_test23.log";
+    std::size_t n = 1 << 20;
+    {
+        std::ofstream out(path);
+        for ( std::size_t i = 0; i < n; ++i ) {
+            out << "GET /item/" << i << " " << (200 + i % 3 * 100) << " " << std::rand() % 5000 << "\n";
+        }
+        /* no newline at the end of the last line */
+        out << "GET /last 200 1";
+    }
+
+    auto status = [] (std::string_view line) {
+        auto sp = line.find(' ', 4);
+        return line.substr(sp + 1, 3);
+    };
+    auto bytes = [] (std::string_view line) {
+        long res = 0;
+        std::from_chars(line.data() + line.rfind(' ') + 1, line.data() + line.size(), res);
+        return res;
+    };
+
+    {
+        TimeInterval _("getline into a vector", n);
+        std::ifstream in(path);
+        std::vector<std::string> lines;
+        for ( std::string line; std::getline(in, line); ) {
+            lines.push_back(line);
+        }
+        std::cout << "Errors: " << makeLazyIterator(lines.begin(), lines.end())
+                                    .filter([&] (auto const &l) { return status(l) == "400"; })
+                                    .count()
+            << "\n";
+    }
+    {
+        TimeInterval _("Mapped lines", n);
+        std::cout << "Errors: " << makeLazyIteratorFromFileLines(path)
+                                    .filter([&] (auto l) { return status(l) == "400"; })
+                                    .count()
+            << "\n";
+    }
+    {
+        TimeInterval _("Count lines", n);
+        std::cout << "Lines: " << makeLazyIteratorFromFileLines(path).count() << "\n";
+    }
+
+    auto parts = parallelSplits(makeLazyIteratorFromFileLines(path),
+            [&] (auto part) { return part.map(bytes).partialAggregate(countOf(), sumOf()); },
+            4);
+    for ( std::size_t i = 1; i < parts.size(); ++i ) {
+        parts[0].merge(parts[i]);
+    }
+    auto [lines, total] = parts[0].result();
+    std::cout << "Split in " << parts.size() << ": " << lines << " lines, " << total << " bytes, "
+        << makeLazyIteratorFromFileLines(path).map(bytes).sum() << "\n";
+
+    /* the parts take the lines, as they take the indexes of an index source */
+    auto source = makeLazyIteratorFromFileLines(path);
+    auto indexes = makeLazyIteratorFromIndex([] (std::size_t i) { return i; }, 10);
+    std::cout << "Parts: " << source.split(3).size() << " and " << indexes.split(3).size()
+        << ", left: " << source.count() << " and " << indexes.count() << "\n";
+
+    auto last = makeLazyIteratorFromFileLines(path)
+                    .skipUntil([] (auto l) { return l.substr(0, 9) == "GET /last"; });
+    std::cout << "Last: " << *last << "\n";
+    std::remove(path.c_str());
+}
+
+void test22() {
+    std::size_t n = 1 << 22;
+    std::vector<int> id(n);
+    std::vector<double> price(n), qty(n), discount(n);
+    std::iota(id.begin(), id.end(), 0);
+    std::generate(price.begin(), price.end(), [] () { return std::rand() % 10000 / 100.0; });
+    std::generate(qty.begin(), qty.end(), [] () { return std::rand() % 10; });
+    std::generate(discount.begin(), discount.end(), [] () { return std::rand() % 30 / 100.0; });
+
+    auto ids = makeLazyIterator(id.begin(), id.end());
+    auto prices = makeLazyIterator(price.begin(), price.end());
+    auto qtys = makeLazyIterator(qty.begin(), qty.end());
+    auto discounts = makeLazyIterator(discount.begin(), discount.end());
+
+    {
+        TimeInterval _("Nested pairs", n);
+        std::cout << "Revenue: "
+            << makeLazyIteratorFromZip(
+                    makeLazyIteratorFromZip(ids, prices),
+                    makeLazyIteratorFromZip(qtys, discounts))
+                .map([] (auto const &e) {
+                        return e.first.second * e.second.first * (1 - e.second.second);
+                    })
+                .sum()
+            << "\n";
+    }
+
+    auto rows = makeLazyIteratorFromZipN(ids, prices, qtys, discounts);
+    static_assert(std::is_same_v<decltype(rows)::value_type,
+                  std::tuple<int const &, double const &, double const &, double const &>>);
+    {
+        TimeInterval _("Tuples of references", n);
+        std::cout << "Revenue: "
+            << rows.dup()
+                .map([] (auto const &e) {
+                        return std::get<1>(e) * std::get<2>(e) * (1 - std::get<3>(e));
+                    })
+                .sum()
+            << "\n";
+    }
+    {
+        TimeInterval _("Columns", n);
+        double revenue = 0;
+        rows.dup().foreachColumns(
+                [&revenue] (auto, auto price, auto qty, auto discount) {
+                    double block = 0;
+                    for ( std::size_t i = 0; i < price.size(); ++i ) {
+                        block += price[i] * qty[i] * (1 - discount[i]);
+                    }
+                    revenue += block;
+                });
+        std::cout << "Revenue: " << revenue << "\n";
+    }
+
+    /* a filter is not sized, the tuple then holds a copy of its element */
+    auto mixed = makeLazyIteratorFromZipN(
+            ids,
+            makeLazyIterator(qty.begin(), qty.end()).filter([] (double q) { return q > 8; }));
+    mixed.advance(2);
+    auto third = *mixed;
+    std::cout << "Third pair: " << std::get<0>(third) << " " << std::get<1>(third) << "\n";
+}
+
+void test21() {
+    using namespace lazy_placeholders;
+
+    std::vector<double> a(1 << 22), b(1 << 22);
+    std::generate(a.begin(), a.end(), [] () { return std::rand() % 1000 / 100.0; });
+    std::generate(b.begin(), b.end(), [] () { return std::rand() % 1000 / 100.0; });
+
+    auto ia = makeLazyIterator(a.begin(), a.end());
+    auto ib = makeLazyIterator(b.begin(), b.end());
+    {
+        TimeInterval _("Zip with, reduce", a.size());
+        std::cout << "Dot: " << makeLazyIteratorFromZipWith(ia, ib,
+                                    [] (double x, double y) { return x * y; })
+                                .reduce([] (double acc, double e) { return acc + e; }, 0.0)
+            << "\n";
+    }
+    {
+        TimeInterval _("Zip with expression, reduce", a.size());
+        std::cout << "Dot: " << makeLazyIteratorFromZipWith(ia, ib, _1 * _2)
+                                .reduce(_1 + _2, 0.0)
+            << "\n";
+    }
+    {
+        TimeInterval _("dot()", a.size());
+        std::cout << "Dot: " << ia.dup().dot(ib) << "\n";
+    }
+
+    /* weights summing to 1 average, over contiguous sides or not */
+    std::vector<double> w(a.size(), 1.0 / a.size());
+    std::cout << "Weighted sum: " << ia.dup().weightedSum(makeLazyIterator(w.begin(), w.end()))
+        << " vs mean " << ia.dup().sum() / a.size()
+        << ", through a map: "
+        << ia.dup().map([] (double x) { return x; }).weightedSum(makeLazyIterator(w.begin(), w.end()))
+        << "\n";
+
+    std::cout << "L2 distance: " << ia.dup().l2Distance(ib)
+        << ", " << std::sqrt(ia.dup().zipReduce(ib, (_1 - _2) * (_1 - _2), _1 + _2, 0.0))
+        << "\n";
+
+    std::vector<int> x = {1, 2, 3, 4, 5}, y = {5, 4, 3, 2, 1};
+    std::cout << "Dot of ints: "
+        << makeLazyIterator(x.begin(), x.end()).dot(makeLazyIterator(y.begin(), y.end()))
+        << ", through a map: "
+        << makeLazyIterator(x.begin(), x.end())
+            .map([] (int e) { return e * 10; })
+            .dot(makeLazyIterator(y.begin(), y.end()))
+        << ", largest product: "
+        << makeLazyIterator(x.begin(), x.end())
+            .zipReduce(makeLazyIterator(y.begin(), y.end()), _1 * _2,
+                       [] (int acc, int e) { return std::max(acc, e); }, 0)
+        << "\n";
+
+    /* both sides consumed, whichever is shorter */
+    auto zipped = makeLazyIteratorFromZipWith(makeLazyIterator(x.begin(), x.end()),
+                                              makeLazyIterator(y.begin(), y.end() - 2), _1 * _2);
+    std::cout << "Zip reduce of a shorter side: " << zipped.reduce(_1 + _2, 0)
+        << ", consumed: " << !zipped.ok() << "\n";
+}
+
+void test20() {
+    std::vector<double> vec(1 << 22);
+    /* a large offset ruins the textbook sum of squares formula */
+    std::generate(vec.begin(), vec.end(), [] () { return 1e9 + std::rand() % 1000 / 10.0; });
+
+    auto scaled = [] (double e) { return e * 2; };
+    {
+        TimeInterval _("Two passes", vec.size());
+        auto values = makeLazyIterator(vec.begin(), vec.end()).map(scaled).done();
+        auto n = values.remaining();
+        auto mean = values.dup().sum() / n;
+        auto m2 = values.reduce([mean] (double acc, double e) { return acc + (e - mean) * (e - mean); }, 0.0);
+        std::cout << "Variance: " << m2 / n << "\n";
+    }
+    {
+        TimeInterval _("Sum of squares", vec.size());
+        auto [n, sum, sq] = makeLazyIterator(vec.begin(), vec.end())
+                    .map(scaled)
+                    .aggregate(countOf(), sumOf(), sumOf([] (double e) { return e * e; }))
+                    ;
+        std::cout << "Variance: " << sq / n - (sum / n) * (sum / n) << "\n";
+    }
+    {
+        TimeInterval _("Welford", vec.size());
+        auto mv = makeLazyIterator(vec.begin(), vec.end())
+                    .map(scaled)
+                    .meanVariance()
+                    ;
+        std::cout << "Variance: " << mv.variance() << ", " << mv << "\n";
+    }
+
+    auto half = vec.size() / 2;
+    auto left = makeLazyIterator(vec.begin(), vec.begin() + half).meanVariance();
+    left.merge(makeLazyIterator(vec.begin() + half, vec.end()).meanVariance());
+    std::cout << "Merged halves: " << left << ", stddev "
+        << makeLazyIterator(vec.begin(), vec.end()).stddev() << "\n";
+
+    std::vector<double> noisy(vec.size());
+    std::transform(vec.begin(), vec.end(), noisy.begin(),
+            [] (double e) { return 3 * e + std::rand() % 100; });
+    auto cm = makeLazyIterator(vec.begin(), vec.end())
+                .covariance(makeLazyIterator(noisy.begin(), noisy.end()));
+    std::cout << "Covariance: " << cm.covariance()
+        << ", Correlation: " << cm.correlation() << ", "
+        << makeLazyIterator(vec.begin(), vec.end())
+            .map(scaled)
+            .correlation(makeLazyIterator(noisy.begin(), noisy.end()))
+        << "\n";
+}
+
+/* counts its copies, to see which stages copy their content */
+struct Counted {
+    int v;
+    static inline std::size_t copies = 0;
+    explicit Counted(int v) : v(v) {}
+    Counted(Counted const &other) : v(other.v) { ++copies; }
+    Counted(Counted &&) = default;
+};
+
+void test19() {
+    {
+        /* one pass over grouped counts, as test4 takes three */
+        std::vector<int> small(100000);
+        std::generate(small.begin(), small.end(), [] () { return std::rand() % 100; });
+        auto groups = makeLazyIterator(small.begin(), small.end())
+                        .done()
+                        .sort()
+                        .groupBy<TWithCount<int>>(tWithCountJoiner<int>);
+        auto count = [] (auto const &e) { return e.count; };
+        auto [sum, minimal, maximal] = groups.dup().aggregate(sumOf(count), minOf(count), maxOf(count));
+        std::cout << "Grouped, same: "
+            << (sum == groups.dup().map(count).sum()
+                && minimal == groups.dup().map(count).numeric_min()
+                && maximal == groups.dup().map(count).numeric_max())
+            << "\n";
+    }
+
+    std::vector<int> vec(1 << 22);
+    std::generate(vec.begin(), vec.end(), [] () { return std::rand() % 10000; });
+
+    /* expensive upstream */
+    auto digits = [] (int e) { return static_cast<int>(std::to_string(e * 7919).size()); };
+    auto iter = makeLazyIterator(vec.begin(), vec.end()).map(digits);
+
+    {
+        TimeInterval _("Three passes", vec.size());
+        auto sum = iter.dup().sum();
+        auto minimal = iter.dup().numeric_min();
+        auto maximal = iter.dup().numeric_max();
+        std::cout << sum << " " << minimal << " " << maximal << "\n";
+    }
+    {
+        TimeInterval _("One pass", vec.size());
+        auto [sum, minimal, maximal, mv] = iter
+                    .dup()
+                    .aggregate(sumOf(), minOf(), maxOf(), meanVar())
+                    ;
+        std::cout << sum << " " << minimal << " " << maximal << " " << mv << "\n";
+    }
+    {
+        TimeInterval _("Parallel", vec.size());
+        auto [sum, minimal, maximal, mv] = iter
+                    .dup()
+                    .parallelAggregate(sumOf(), minOf(), maxOf(), meanVar())
+                    ;
+        std::cout << sum << " " << minimal << " " << maximal << " " << mv << "\n";
+    }
+
+    {
+        /* contiguous content is split into views: sorted once, not copied */
+        auto sorted = makeLazyIterator(vec.begin(), vec.end()).done().sort(std::greater<>());
+        auto wide = [] (int e) { return static_cast<long>(e); };
+        auto parallel = sorted.dup().parallelAggregate(sumOf(wide), minOf(), maxOf(), countOf());
+        auto serial = sorted.aggregate(sumOf(wide), minOf(), maxOf(), countOf());
+        std::cout << "Parallel over a sorted source, same: " << (parallel == serial) << "\n";
+    }
+    {
+        /* a map over done() content is cut into views, the content is not
+         * copied: no more copies of elements than a serial pass makes
+         */
+        auto content = makeLazyIterator(vec.begin(), vec.end())
+                        .map([] (int e) { return Counted(e); })
+                        .done();
+        auto value = [] (Counted const &c) { return static_cast<long>(c.v); };
+        auto mapped = content.dup().map(value);
+        Counted::copies = 0;
+        auto parallel = mapped.parallelAggregate(sumOf(), minOf(), maxOf());
+        auto parallel_copies = Counted::copies;
+        auto serial_mapped = content.map(value);
+        Counted::copies = 0;
+        auto serial = serial_mapped.aggregate(sumOf(), minOf(), maxOf());
+        std::cout << "Parallel over a map, same: " << (parallel == serial)
+            << ", copies as serial: " << (parallel_copies == Counted::copies);
+
+        auto reversed = makeLazyIterator(vec.begin(), vec.end()).done().reverse()
+                        .map([] (int e) { return static_cast<long>(e); });
+        auto parallel_reversed = reversed.dup().parallelAggregate(sumOf(), countOf());
+        auto iota = makeLazyIteratorFromIota(0L, 1L << 20).parallelAggregate(sumOf(), countOf());
+        std::cout << ", reversed: " << (parallel_reversed == reversed.aggregate(sumOf(), countOf()))
+            << ", over an iota: "
+            << (iota == makeLazyIteratorFromIota(0L, 1L << 20).aggregate(sumOf(), countOf()))
+            << "\n";
+    }
+
+    /* two halves summarized apart, then merged */
+    auto half = vec.size() / 2;
+    auto left = makeLazyIterator(vec.begin(), vec.begin() + half)
+                    .partialAggregate(countOf(), meanVar());
+    auto right = makeLazyIterator(vec.begin() + half, vec.end())
+                    .partialAggregate(countOf(), meanVar());
+    left.merge(right);
+    auto [n, mv] = left.result();
+    std::cout << "Merged halves: " << n << " " << mv << "\n";
+}
+
+void test18() {
+    std::vector<int> vec(1 << 20);
+    std::generate(vec.begin(), vec.end(), [] () { return std::rand() % 1000000; });
+    using Raw = LazyIteratorRaw<std::vector<int>::iterator>;
+
+    /* the rewrites are visible in the types */
+    auto twice = makeLazyIterator(vec.begin(), vec.end()).take(100).take(10);
+    static_assert(std::is_same_v<decltype(twice), LazyIteratorWithTake<Raw>>);
+
+    auto desc = makeLazyIterator(vec.begin(), vec.end()).done().sort().reverse();
+    static_assert(std::is_same_v<decltype(desc),
+                                 LazyIteratorWithSortedContent<int, std::greater<>>>);
+
+    auto top = makeLazyIterator(vec.begin(), vec.end()).done().sort(std::greater<>()).take(5);
+    static_assert(std::is_same_v<decltype(top), LazyIteratorWithVectorContent<int>>);
+
+    std::cout << "Take twice: " << twice.count() << "\n";
+    std::cout << "Top 5:";
+    top.dup().foreach([] (int e) { std::cout << " " << e; });
+    std::cout << "\n";
+    std::cout << "Descending starts with top 5: "
+        << (desc.take(5).done().sum() == top.sum()) << "\n";
+
+    std::size_t compares = 0;
+    auto counted = makeLazyIterator(vec.begin(), vec.begin() + 1000)
+                    .done()
+                    .sort([&compares] (int a, int b) { ++compares; return a < b; });
+    auto first = counted.dup();
+    auto once = compares;
+    auto second = counted.dup();
+    std::cout << "Sorted once for two copies: " << (once > 0 && compares == once)
+        << ", Same: " << (first.sum() == second.sum()) << "\n";
+
+    /* a const sorted source can be copied, and keeps the vector content API */
+    auto total = makeLazyIterator(vec.begin(), vec.begin() + 1000).sum();
+    auto const frozen = makeLazyIterator(vec.begin(), vec.begin() + 1000).done().sort();
+    auto thawed = frozen;
+    auto running = makeLazyIterator(vec.begin(), vec.begin() + 1000).done().sort()
+                    .parallelScan(std::plus<>(), 0);
+    auto before = makeLazyIterator(vec.begin(), vec.begin() + 1000).done().sort()
+                    .parallelExclusiveScan(std::plus<>(), 0);
+    std::cout << "Copied from const: " << (thawed.sum() == total)
+        << ", Scanned sorted: " << (running.reverse().dup().numeric_max() == total)
+        << " " << (*before == 0) << "\n";
+
+    std::size_t calls = 0;
+    auto n = makeLazyIterator(vec.begin(), vec.end())
+                .map([&calls] (int e) { ++calls; return e * 2; })
+                .count()
+                ;
+    std::cout << "Counted " << n << " after " << calls << " map calls\n";
+
+    {
+        TimeInterval _("Sort then take", vec.size());
+        makeLazyIterator(vec.begin(), vec.end())
+            .done()
+            .sort(std::greater<>())
+            .done()
+            .take(5)
+            .done()
+            ;
+    }
+    {
+        TimeInterval _("Partial sort", vec.size());
+        makeLazyIterator(vec.begin(), vec.end())
+            .done()
+            .sort(std::greater<>())
+            .take(5)
+            ;
+    }
+}
+
+void test17() {
+    std::vector<int> vec(1 << 22);
+    std::generate(vec.begin(), vec.end(), [] () { return std::rand() % 10000; });
+
+    /* expensive */
+    auto no_seven = [] (int e) { return std::to_string(e).find('7') == std::string::npos; };
+    /* cheap and rejects half */
+    auto even = [] (int e) { return e % 2 == 0; };
+    /* cheap and rejects most */
+    auto small = [] (int e) { return e < 1000; };
+
+    std::size_t fixed_count = 0, adaptive_count = 0;
+    {
+        TimeInterval _("Written order", vec.size());
+        fixed_count = makeLazyIterator(vec.begin(), vec.end())
+                        .stopWhen([] (int) { return false; })
+                        .filter(no_seven)
+                        .filter(even)
+                        .filter(small)
+                        .count()
+                        ;
+    }
+
+    auto adaptive = makeLazyIterator(vec.begin(), vec.end())
+                        .filterAll(no_seven, even, small)
+                        ;
+    {
+        TimeInterval _("Adaptive order", vec.size());
+        adaptive_count = adaptive.count();
+    }
+    std::cout << "Same: " << (fixed_count == adaptive_count) << ", Order:";
+    for ( auto i : adaptive.order() ) std::cout << " " << i;
+    std::cout << "\n";
+
+    std::cout << "Sampled from a filter: "
+        << makeLazyIterator(vec.begin(), vec.end())
+            .filter(even)
+            .sampleFraction(0.5)
+            .sample(3)
+            .count()
+        << "\n";
+}
+
+void test16() {
+    using namespace lazy_placeholders;
+
+    auto is_even = _1 % 2 == 0;
+    static_assert(std::is_same_v<decltype(is_even),
+            LazyExpr<ExprBinary<std::equal_to<>,
+                LazyExpr<ExprBinary<std::modulus<>, LazyExpr<ExprArg<0>>, LazyExpr<ExprConst<int>>>>,
+                LazyExpr<ExprConst<int>>>>>,
+            "expression trees are types");
+
+    std::vector<int> vec(1 << 24);
+    std::generate(vec.begin(), vec.end(), [] () { return std::rand() % 10000; });
+
+    long lambdas = 0, placeholders = 0;
+    {
+        TimeInterval _("Lambdas", vec.size());
+        lambdas = makeLazyIterator(vec.begin(), vec.end())
+                    .filter([] (auto e) { return e % 2 == 0; })
+                    .map([] (auto e) { return e * e % 10000; })
+                    .sum()
+                    ;
+    }
+    {
+        TimeInterval _("Placeholders", vec.size());
+        placeholders = makeLazyIterator(vec.begin(), vec.end())
+                        .filter(_1 % 2 == 0)
+                        .map(_1 * _1 % _c<10000>)
+                        .sum()
+                        ;
+    }
+    std::cout << "Sum: " << placeholders << ", Same: " << (lambdas == placeholders) << "\n";
+
+    /* a power of 2 known at compile time takes the mask and shift too */
+    auto mod8 = _1 % _c<8>;
+    auto div8 = _1 / _c<8>;
+    std::cout << "-13 % 8: " << mod8(-13) << ", -13 / 8: " << div8(-13)
+        << ", 13 % 8: " << mod8(13) << ", 13 / 8: " << div8(13) << "\n";
+
+    makeLazyIteratorFromGenerator(StupidConjecture<long>(27))
+        .stopWhen(_1 == 1)
+        .filter(_1 > 1000 && _1 % 2 == 1)
+        .foreach(printer)
+        ;
+
+    std::vector<std::string> words = {"hello", "moon", "goodbye", "sun"};
+    makeLazyIterator(words.begin(), words.end())
+        .map([] (auto const &e) { return std::make_pair(e, e.size()); })
+        .filter(_1.second > 4)
+        .map(_1.first)
+        .done()
+        .sort(_1 > _2)
+        .foreach(printer)
+        ;
+}
+
+void test15() {
+    std::vector<int> vec(1 << 24);
+    std::generate(vec.begin(), vec.end(), [] () { return std::rand() % 10000; });
+
+    auto never = [] (int) { return false; };
+    long scalar = 0, batched = 0;
+
+    {
+        TimeInterval _("Element at a time", vec.size());
+        scalar = makeLazyIterator(vec.begin(), vec.end())
+                    .stopWhen(never)
+                    .filter([] (auto e) { return e % 2 == 0; })
+                    .map([] (auto e) { return long(e) * e % 10000; })
+                    .sum()
+                    ;
+    }
+
+    {
+        TimeInterval _("Batch at a time", vec.size());
+        batched = makeLazyIterator(vec.begin(), vec.end())
+                    .filter([] (auto e) { return e % 2 == 0; })
+                    .map([] (auto e) { return long(e) * e % 10000; })
+                    .sum()
+                    ;
+    }
+
+    std::cout << "Sum: " << batched << ", Same: " << (scalar == batched) << "\n";
+
+    std::cout << "Count: "
+        << makeLazyIterator(vec.begin(), vec.end())
+                .filter([] (auto e) { return e < 10; })
+                .take(1000)
+                .count()
+        << ", Max: "
+        << makeLazyIterator(vec.begin(), vec.end())
+                .map([] (auto e) { return e - 5000; })
+                .take(1500)
+                .numeric_max()
+        << "\n";
+}
+
+void test14() {
+    std::vector<int> vec(10);
+    std::iota(vec.begin(), vec.end(), 0);
+
+    makeLazyIterator(vec.begin(), vec.end())
+        .batch(4)
+        .foreach(printer)
+        ;
+
+    makeLazyIterator(vec.begin(), vec.end())
+        .filter([] (int e) { return e % 3 != 0; })
+        .batch(4)
+        .foreach(printer)
+        ;
+
+    std::vector<float> samples(1 << 20, 0.5f);
+    float total = 0;
+    {
+        TimeInterval _("foreachBatch", samples.size());
+        makeLazyIterator(samples.begin(), samples.end())
+            .foreachBatch([&total] (auto span) {
+                        float acc = 0;
+                        for ( auto e : span ) acc += e;
+                        total += acc;
+                    });
+    }
+    std::cout << "Total: " << total << "\n";
+}
+
+void test13() {
+    std::vector<std::string> lines = {
+        "the quick", "", "brown fox", "jumps",
+    };
+
+    makeLazyIterator(lines.begin(), lines.end())
+        .flatMap([] (auto const &line) { return line; })
+        .filter([] (char c) { return c != ' '; })
+        .foreach([] (char c) { std::cout << c; })
+        ;
+    std::cout << "\n";
+
+    makeLazyIteratorFromGenerator(StupidGen(), 4)
+        .flatMap([] (int e) { return makeLazyIteratorFromGenerator(StupidGen(), e); })
+        .foreach([] (int e) { std::cout << e << " "; })
+        ;
+    std::cout << "\n";
+
+    std::vector<int> vec = {0, 1, 2, 3};
+    auto pairs = makeLazyIterator(vec.begin(), vec.end())
+                    .flatMap([] (int e) { return std::array<int, 2>{e, -e}; })
+                    ;
+    std::cout << "Known size: " << pairs.remaining() << "\n";
+    pairs
+        .dup()
+        .foreach([] (int e) { std::cout << e << " "; })
+        ;
+    std::cout << "\n";
+
+    std::vector<int> a = {1, 2, 3}, b = {}, c = {4, 5};
+    auto all = makeLazyIterator(a.begin(), a.end())
+                .concat(makeLazyIterator(b.begin(), b.end()),
+                        makeLazyIterator(c.begin(), c.end()))
+                ;
+    auto last = all.dup();
+    last.advance(4);
+    std::cout << "Remaining: " << all.remaining() << ", Sum: " << all.dup().sum()
+        << ", Last: " << *last << "\n";
+}
+
+void test12() {
+    makeLazyIteratorFromGenerator(StupidGen(), 6)
+        .scan(std::plus<int>(), 0)
+        .foreach(printer)
+        ;
+
+    makeLazyIteratorFromGenerator(StupidGen(), 6)
+        .exclusiveScan([] (std::string a, int e) { return a + std::to_string(e); }, std::string(">"))
+        .foreach(printer)
+        ;
+
+    std::vector<long> vec(1 << 22);
+    std::generate(vec.begin(), vec.end(), [] () { return std::rand() % 100; });
+
+    std::vector<long> expected(vec.size());
+    {
+        TimeInterval _("Sequential scan", vec.size());
+        std::partial_sum(vec.begin(), vec.end(), expected.begin());
+    }
+
+    auto offsets = makeLazyIterator(vec.begin(), vec.end()).done();
+    {
+        TimeInterval _("Parallel scan", vec.size());
+        offsets.parallelScan(std::plus<>(), 0L, 4);
+    }
+    std::cout << "Parallel scan matches: "
+        << makeLazyIteratorFromZipWith(
+                makeLazyIterator(expected.begin(), expected.end()),
+                offsets.dup(),
+                [] (long a, long b) { return a == b; })
+            .reduce([] (bool a, bool b) { return a && b; }, true)
+        << "\n";
+
+    std::vector<int> small = {3, 1, 4, 1, 5, 9, 2, 6, 5, 3};
+    makeLazyIterator(small.begin(), small.end())
+        .done()
+        .parallelExclusiveScan(std::plus<>(), 0)
+        .foreach([] (auto e) { std::cout << e << " "; })
+        ;
+    std::cout << "\n";
+}
+
+void test11() {
+    /* (timestamp, latency) */
+    std::vector<std::pair<int, double>> metrics = {
+        {1, 2.5}, {3, 1.0}, {9, 4.0}, {10, 3.0}, {14, 0.5},
+        {31, 8.0}, {33, 2.0}, {70, 1.5},
+    };
+    auto stamp = [] (auto const &e) { return e.first; };
+    auto add_latency = [] (double &acc, auto const &e) { acc += e.second; };
+
+    std::cout << "---- Tumbling 10:\n";
+    makeLazyIterator(metrics.begin(), metrics.end())
+        .tumblingWindow<double>(stamp, 10, add_latency)
+        .foreach(printer)
+        ;
+
+    std::cout << "---- Session gap 5:\n";
+    makeLazyIterator(metrics.begin(), metrics.end())
+        .sessionWindow<double>(stamp, 5, add_latency)
+        .foreach(printer)
+        ;
+}
+
+void test10() {
+    auto noisy = makeLazyIteratorFromGenerator(StupidConjecture<long>(27))
+                    .stopWhen([] (auto e) { return e == 1; })
+                    ;
+
+    std::cout << "---- Rolling max of 5:\n";
+    noisy
+        .dup()
+        .window(5)
+        .numeric_max()
+        .take(10)
+        .foreach(printer)
+        ;
+
+    std::cout << "---- Rolling mean of 3:\n";
+    noisy
+        .dup()
+        .window(3)
+        .mean()
+        .take(10)
+        .foreach(printer)
+        ;
+
+    auto naive_ok = makeLazyIteratorFromGenerator(StupidGen(), 1000)
+                    .window(7)
+                    .sum()
+                    .map([i = 0] (auto e) mutable {
+                            int expected = 7 * i + 21;
+                            ++i;
+                            return e == expected;
+                        })
+                    .reduce([] (bool a, bool b) { return a && b; }, true)
+                    ;
+    std::cout << "Rolling sum matches: " << naive_ok << "\n";
+}
+
+void test9() {
+    std::vector<int> vec(1000000);
+    std::iota(vec.begin(), vec.end(), 0);
+
+    {
+        TimeInterval _("Reservoir sample", vec.size());
+        makeLazyIterator(vec.begin(), vec.end())
+            .map([] (auto e) { return e * 2; })
+            .sample(5)
+            .sort()
+            .foreach(printer)
+            ;
+    }
+
+    {
+        TimeInterval _("Bernoulli sample", vec.size());
+        auto sampled = makeLazyIterator(vec.begin(), vec.end())
+                        .sampleFraction(0.01)
+                        .count()
+                        ;
+        std::cout << "Sampled about 1%: " << sampled << "\n";
+    }
+
+    {
+        auto all = makeLazyIterator(vec.begin(), vec.end()).sampleFraction(1.0).count(),
+             more = makeLazyIterator(vec.begin(), vec.end()).sampleFraction(2.0).count(),
+             none = makeLazyIterator(vec.begin(), vec.end()).sampleFraction(0.0).count();
+        std::cout << "p = 1: " << all << ", p = 2: " << more << ", p = 0: " << none << "\n";
+    }
+    {
+        /* after a filter, which skips with its own stepping */
+        auto even = [] (int e) { return e % 2 == 0; };
+        std::cout << "Filtered then sampled: "
+            << makeLazyIterator(vec.begin(), vec.end()).filter(even).sample(3).count() << " and "
+            << (makeLazyIterator(vec.begin(), vec.end()).filter(even).sampleFraction(2.0).count()
+                    == makeLazyIterator(vec.begin(), vec.end()).filter(even).count())
+            << "\n";
+    }
+}
+
+void test8() {
+    std::vector<int> vec(100000);
+    std::generate(vec.begin(), vec.end(), [] () { return std::rand() % 1000; });
+
+    auto sketch = makeLazyIterator(vec.begin(), vec.begin() + vec.size() / 2)
+                    .approxQuantiles()
+                    ;
+    sketch.merge(
+            makeLazyIterator(vec.begin() + vec.size() / 2, vec.end())
+                .approxQuantiles()
+            );
+
+    std::cout << "Count: " << sketch.count()
+        << ", Median: " << sketch.quantile(0.5)
+        << ", P99: " << sketch.quantile(0.99) << "\n";
+
+    auto hitters = makeLazyIteratorFromGenerator(StupidConjecture<long>(27))
+                    .stopWhen([] (auto e) { return e == 1; })
+                    .map([] (auto e) { return e % 10; })
+                    .heavyHitters(3)
+                    ;
+    for ( auto const &hh : hitters.top() ) {
+        std::cout << hh << "\n";
+    }
+}
+
 void test7() {
     std::vector<int> a = {1, 5, 8, 23, 6, 17, 11, 23, 12, 2};
     std::vector<std::string> b = {
@@ -287,4 +1614,29 @@ int main() {
     test4();
     test5();
     test7();
+    test8();
+    test9();
+    test10();
+    test11();
+    test12();
+    test13();
+    test14();
+    test15();
+    test16();
+    test17();
+    test18();
+    test19();
+    test20();
+    test21();
+    test22();
+    test23();
+    test24();
+    test25();
+    test26();
+    test27();
+    test28();
+    test29();
+    test30();
+    test31();
+    test32();
 }
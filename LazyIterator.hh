@@ -10,6 +10,23 @@
 #include <iostream>
 #include <cstdlib>
 #include <limits>
+#include <random>
+#include <cstdint>
+#include <tuple>
+#include <array>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include <chrono>
+#include <numeric>
+#include <cmath>
+
+#include "Sketches.hh"
+#include "Aggregators.hh"
+#include "Kernels.hh"
+#include "LazyExpr.hh"
 
 #define throw_stop_iteration()              \
     throw StopIteration(__func__);
@@ -40,14 +57,160 @@ private:
 template<class Derived>
 class LazyIteratorBase;
 
+/* see LazyColumns.hh */
+template<class T>
+class ColumnFileWriter;
+
+/* see LazyWriter.hh, needed only by writeTo() and saveSnapshot() */
+class BufferedWriter;
+struct LazyFormat;
+
+template<class Iterator>
+std::size_t lazy_write_snapshot(std::string const &path, Iterator beg, Iterator end);
+
+/* T, named through D so that its use waits for D */
+template<class T, class D>
+struct lazy_dependent {
+    using type = T;
+};
+
+template<class T, class D>
+using lazy_dependent_t = typename lazy_dependent<T, D>::type;
+
+/* Sized concept:
+ *  std::size_t remaining(), the exact number of elements left
+ *
+ * stages offer remaining() only when their inputs do
+ */
+/* Viewable concept:
+ *  auto view(std::size_t beg, std::size_t end), the elements [beg, end)
+ *      from here, end <= remaining(), as a stage that does not own the
+ *      content: valid while this one lives, which is left as it is
+ *
+ * parallelAggregate() cuts a pipeline into views rather than copies
+ */
+/* Batchable concept:
+ *  static constexpr bool batchable = true;
+ *  std::size_t nextBatch(ColumnBatch<value_type> &out, std::size_t limit);
+ *      fills out with at most limit rows, 0 rows only at the end
+ *
+ * reduce() and count() run batch at a time when the whole pipeline is
+ * batchable, that is for sources, map, filter and take over arithmetic
+ * value_types. Filter and map functions are then called for a whole
+ * batch before anything downstream sees it.
+ */
+template<class T>
+struct ColumnBatch {
+    static constexpr std::size_t capacity = lazy_expr_batch;
+
+    /* rows values, either storage or a view of the source */
+    T const         *values = nullptr;
+    std::size_t     rows = 0;
+    /* when !dense, only the rows sel[0, selected) are present */
+    bool            dense = true;
+    std::size_t     selected = 0;
+    std::uint16_t   sel[capacity];
+    T               storage[capacity];
+
+    std::size_t size() const {
+        return dense ? rows : selected;
+    }
+
+    /* f(value) for each present row, in order */
+    template<class F>
+    void foreach(F f) const {
+        if ( dense ) {
+            for ( std::size_t i = 0; i < rows; ++i ) f(values[i]);
+        } else {
+            for ( std::size_t j = 0; j < selected; ++j ) f(values[sel[j]]);
+        }
+    }
+};
+
+template<class Iterator, class = void>
+struct has_remaining : std::false_type {};
+
+template<class Iterator>
+struct has_remaining<Iterator, std::void_t<decltype(std::declval<Iterator&>().remaining())>>
+    : std::true_type {};
+
+template<class Iterator>
+constexpr bool has_remaining_v = has_remaining<Iterator>::value;
+
+template<class Iterator, class = void>
+struct has_view : std::false_type {};
+
+template<class Iterator>
+struct has_view<Iterator, std::void_t<decltype(std::declval<Iterator&>().view(std::size_t(), std::size_t()))>>
+    : std::true_type {};
+
+template<class Iterator>
+constexpr bool has_view_v = has_view<Iterator>::value;
+
+template<class Iterator, class = void>
+struct has_split : std::false_type {};
+
+template<class Iterator>
+struct has_split<Iterator, std::void_t<decltype(std::declval<Iterator&>().split(std::size_t()))>>
+    : std::true_type {};
+
+template<class Iterator>
+constexpr bool has_split_v = has_split<Iterator>::value;
+
+template<class Iterator>
+constexpr bool is_lazy_iterator_v = std::is_base_of_v<LazyIteratorBase<Iterator>, Iterator>;
+
 template<class Iterator>
+constexpr bool is_random_access_v = std::is_base_of_v<std::random_access_iterator_tag,
+                                    typename std::iterator_traits<Iterator>::iterator_category>;
+
+/* iterators known to walk a plain array */
+template<class Iterator, class V = typename std::iterator_traits<Iterator>::value_type>
+constexpr bool is_contiguous_iterator_v = std::is_pointer_v<Iterator>
+    || (!std::is_same_v<V, bool>
+        && (std::is_same_v<Iterator, typename std::vector<V>::iterator>
+            || std::is_same_v<Iterator, typename std::vector<V>::const_iterator>))
+    || std::is_same_v<Iterator, typename std::basic_string<V>::iterator>
+    || std::is_same_v<Iterator, typename std::basic_string<V>::const_iterator>;
+
+/* a view of size() elements from data(), valid until the iterator yielding it moves */
+template<class T>
+struct Span {
+    T               *ptr = nullptr;
+    std::size_t     len = 0;
+
+    T *data() const { return ptr; }
+    std::size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    T *begin() const { return ptr; }
+    T *end() const { return ptr + len; }
+    T &operator[](std::size_t i) const { return ptr[i]; }
+
+    friend std::ostream &operator<<(std::ostream &os, Span const &sp) {
+        os << "{";
+        for ( std::size_t i = 0; i < sp.len; ++i ) {
+            os << (i ? "," : "") << sp.ptr[i];
+        }
+        os << "}";
+        return os;
+    }
+};
+
+/* Derived: void, or the subclass that extends LazyIteratorRaw, so that
+ * the combinators in LazyIteratorBase copy the full subclass instead of
+ * slicing it down to a LazyIteratorRaw
+ */
+template<class Iterator, class Derived = void>
 class LazyIteratorRaw
-    : public LazyIteratorBase<LazyIteratorRaw<Iterator>>
+    : public LazyIteratorBase<std::conditional_t<std::is_void_v<Derived>,
+                                                 LazyIteratorRaw<Iterator>, Derived>>
 {
-    using self_type = LazyIteratorRaw;
+    using self_type = std::conditional_t<std::is_void_v<Derived>,
+                                         LazyIteratorRaw, Derived>;
 
 public:
     using value_type = typename std::iterator_traits<Iterator>::value_type;
+    static constexpr bool contiguous = is_contiguous_iterator_v<Iterator>;
 
     LazyIteratorRaw(Iterator beg, Iterator end)
         : beg(beg)
@@ -59,12 +222,15 @@ public:
     self_type &operator++() {
         must_ok();
         ++beg;
-        return *this;
+        return static_cast<self_type&>(*this);
     }
 
+    /* the whole subclass: a view alone would outlive the content or the
+     * mapping it points into
+     */
     self_type operator++(int) {
         must_ok();
-        self_type res = *this;
+        self_type res = static_cast<self_type&>(*this);
         ++beg;
         return res;
     }
@@ -78,6 +244,52 @@ public:
         return beg != end;
     }
 
+    template<class I = Iterator, class = std::enable_if_t<is_random_access_v<I>>>
+    std::size_t remaining() {
+        return end - beg;
+    }
+
+    static constexpr bool batchable = std::is_arithmetic_v<value_type>;
+
+    std::size_t nextBatch(ColumnBatch<value_type> &out, std::size_t limit) {
+        limit = std::min(limit, ColumnBatch<value_type>::capacity);
+        out.dense = true;
+        if constexpr ( is_contiguous_iterator_v<Iterator> ) {
+            out.values = std::addressof(*beg);
+            out.rows = std::min<std::size_t>(limit, end - beg);
+            beg += out.rows;
+        } else {
+            out.rows = 0;
+            for ( ; out.rows < limit && beg != end; ++beg ) {
+                out.storage[out.rows++] = *beg;
+            }
+            out.values = out.storage;
+        }
+        return out.rows;
+    }
+
+    /* the remaining() elements from here, when contiguous */
+    template<class I = Iterator, class = std::enable_if_t<is_contiguous_iterator_v<I>>>
+    value_type const *data() {
+        return std::addressof(*beg);
+    }
+
+    std::size_t advance(std::size_t howmany) {
+        if constexpr ( is_random_access_v<Iterator> ) {
+            auto step = std::min<std::size_t>(howmany, end - beg);
+            beg += step;
+            return step;
+        } else {
+            return LazyIteratorBase<self_type>::advance(howmany);
+        }
+    }
+
+    /* the iterators alone, without the content of a subclass */
+    template<class I = Iterator, class = std::enable_if_t<is_random_access_v<I>>>
+    LazyIteratorRaw<Iterator> view(std::size_t b, std::size_t e) {
+        return LazyIteratorRaw<Iterator>(beg + b, beg + e);
+    }
+
 protected:
     Iterator beg;
     Iterator end;
@@ -87,13 +299,16 @@ protected:
     }
 };
 
+template<class T, class Compare>
+class LazyIteratorWithSortedContent;
+
 template<
     class T,
     class VectorIterator = typename std::vector<T>::iterator>
 class LazyIteratorWithVectorContent
-    : public LazyIteratorRaw<VectorIterator>
+    : public LazyIteratorRaw<VectorIterator, LazyIteratorWithVectorContent<T, VectorIterator>>
 {
-    using self_type = LazyIteratorWithVectorContent<T>;
+    using self_type = LazyIteratorWithVectorContent;
 public:
     LazyIteratorWithVectorContent(std::vector<T> &&vec, VectorIterator vecbeg, VectorIterator vecend)
         : vec(std::move(vec))
@@ -118,17 +333,75 @@ public:
         init();
     }
 
-    self_type &sort() {
+    /* beg/end point into vec, so a copy must point into its own vec;
+     * moving a std::vector keeps its buffer, so moves need no care
+     */
+    LazyIteratorWithVectorContent(self_type const &other)
+        : LazyIteratorRaw<VectorIterator, self_type>()
+        , vec(other.vec)
+    {
+        rebase(other);
+    }
+
+    self_type &operator=(self_type const &other) {
+        if ( this != &other ) {
+            vec = other.vec;
+            rebase(other);
+        }
+        return *this;
+    }
+
+    LazyIteratorWithVectorContent(self_type &&) = default;
+    self_type &operator=(self_type &&) = default;
+
+    self_type &sort() & {
         std::sort(vec.begin(), vec.end());
         return *this;
     }
 
     template<class Compare>
-    self_type &sort(Compare compare) {
+    self_type &sort(Compare compare) & {
         std::sort(vec.begin(), vec.end(), compare);
         return *this;
     }
 
+    auto sort() && {
+        return std::move(*this).sort(std::less<>());
+    }
+
+    /* sorting a temporary is deferred, see LazyIteratorWithSortedContent */
+    template<class Compare>
+    auto sort(Compare compare) && {
+        if constexpr ( std::is_same_v<VectorIterator, typename std::vector<T>::iterator> ) {
+            return LazyIteratorWithSortedContent<T, Compare>(std::move(*this).rest(), compare);
+        } else {
+            sort(compare);
+            return std::move(*this);
+        }
+    }
+
+    /*
+     * Binary: (T, T) -> T, associative
+     *
+     * in place running reduction, split over nthreads (0: all cores);
+     * std::plus<> over integers runs SIMD
+     */
+    template<class Binary>
+    self_type &parallelScan(Binary binary, T init, std::size_t nthreads = 0) {
+        static_assert(std::is_same_v<VectorIterator, typename std::vector<T>::iterator>,
+                "parallelScan needs the content in its original order");
+        kernel_parallel_scan<true>(vec.data(), vec.data(), vec.size(), binary, init, nthreads);
+        return *this;
+    }
+
+    template<class Binary>
+    self_type &parallelExclusiveScan(Binary binary, T init, std::size_t nthreads = 0) {
+        static_assert(std::is_same_v<VectorIterator, typename std::vector<T>::iterator>,
+                "parallelExclusiveScan needs the content in its original order");
+        kernel_parallel_scan<false>(vec.data(), vec.data(), vec.size(), binary, init, nthreads);
+        return *this;
+    }
+
     auto reverse() {
         using ReverseVectorIterator = std::reverse_iterator<VectorIterator>;
         auto rbeg = ReverseVectorIterator(this->end),
@@ -141,14 +414,275 @@ public:
                 std::move(vec), rbeg, rend
                 );
     }
+
+    /* the elements left, in order, as a file makeLazyIteratorFromSnapshot<T>()
+     * maps back read only without parsing; T trivially copyable. Needs
+     * LazyWriter.hh
+     */
+    std::size_t saveSnapshot(std::string const &path) {
+        if constexpr ( std::is_same_v<VectorIterator, typename std::vector<T>::iterator> ) {
+            return lazy_write_snapshot(path, vec.data() + (this->beg - vec.begin()),
+                                       vec.data() + (this->end - vec.begin()));
+        } else {
+            return lazy_write_snapshot(path, this->beg, this->end);
+        }
+    }
 private:
+    template<class, class>
+    friend class LazyIteratorWithSortedContent;
+
     void init() {
         this->beg = vec.begin();
         this->end = vec.end();
     }
+
+    /* the elements not iterated yet, moved out when that is all of them */
+    std::vector<T> rest() && {
+        if ( this->beg == first() && this->end == vec.end() ) {
+            return std::move(vec);
+        }
+        return std::vector<T>(this->beg, this->end);
+    }
+
+    VectorIterator first() {
+        if constexpr ( std::is_same_v<VectorIterator, typename std::vector<T>::iterator> ) {
+            return vec.begin();
+        } else {
+            return VectorIterator(vec.end());
+        }
+    }
+
+    /* from the first element, without a non const first() */
+    std::ptrdiff_t offset(VectorIterator it) const {
+        if constexpr ( std::is_same_v<VectorIterator, typename std::vector<T>::iterator> ) {
+            return it - vec.begin();
+        } else {
+            return it - std::make_reverse_iterator(vec.end());
+        }
+    }
+
+    void rebase(self_type const &other) {
+        if ( other.beg == VectorIterator{} ) {
+            this->reset();
+            return;
+        }
+        this->beg = first() + other.offset(other.beg);
+        this->end = first() + other.offset(other.end);
+    }
+
     std::vector<T> vec;
 };
 
+/* compare with its arguments swapped, a descending order for an ascending one */
+template<class Compare>
+struct ReverseCompare {
+    Compare compare;
+
+    template<class A, class B>
+    bool operator()(A const &a, B const &b) const {
+        return compare(b, a);
+    }
+};
+
+template<class Compare>
+ReverseCompare<Compare>
+reverse_compare(Compare compare)
+{
+    return {compare};
+}
+
+template<class Compare>
+Compare
+reverse_compare(ReverseCompare<Compare> reversed)
+{
+    return reversed.compare;
+}
+
+template<class T>
+std::greater<T>
+reverse_compare(std::less<T>)
+{
+    return {};
+}
+
+template<class T>
+std::less<T>
+reverse_compare(std::greater<T>)
+{
+    return {};
+}
+
+/*
+ * The content of a temporary LazyIteratorWithVectorContent, sorted by
+ * compare on first access, so that what is chained after the sort can
+ * replace it by something cheaper:
+ *
+ *  sort(c).take(k)     partial sort of the first k only,
+ *                      a LazyIteratorWithVectorContent of k elements
+ *  sort(c).reverse()   sort(reverse_compare(c)), std::less<> becomes std::greater<>
+ *  sort(c).sort(d)     sort(d), the order by c does not survive
+ *
+ * The rewrites on an lvalue work on a copy.
+ */
+template<class T, class Compare>
+class LazyIteratorWithSortedContent
+    : public LazyIteratorBase<LazyIteratorWithSortedContent<T, Compare>>
+{
+    using self_type = LazyIteratorWithSortedContent;
+    using Content = LazyIteratorWithVectorContent<T>;
+public:
+    using value_type = T;
+    static constexpr bool contiguous = Content::contiguous;
+    static constexpr bool batchable = Content::batchable;
+
+    LazyIteratorWithSortedContent(std::vector<T> &&vec, Compare compare)
+        : vec_(std::move(vec))
+        , compare_(compare)
+    {}
+
+    /* other is sorted before it is copied, so that however many dup()
+     * there are the sort runs once
+     */
+    LazyIteratorWithSortedContent(self_type const &other)
+        : compare_(other.compare_)
+        , content_(other.sorted())
+    {}
+
+    self_type &operator=(self_type const &other) {
+        if ( this != &other ) {
+            vec_.clear();
+            compare_ = other.compare_;
+            content_ = other.sorted();
+        }
+        return *this;
+    }
+
+    LazyIteratorWithSortedContent(self_type &&) = default;
+    self_type &operator=(self_type &&) = default;
+
+    self_type &operator++() {
+        ++sorted();
+        return *this;
+    }
+
+    auto operator++(int) {
+        return sorted()++;
+    }
+
+    value_type operator*() {
+        return *sorted();
+    }
+
+    bool ok() {
+        return sorted().ok();
+    }
+
+    std::size_t remaining() {
+        return sorted().remaining();
+    }
+
+    std::size_t nextBatch(ColumnBatch<value_type> &out, std::size_t limit) {
+        return sorted().nextBatch(out, limit);
+    }
+
+    template<bool C = contiguous, class = std::enable_if_t<C>>
+    value_type const *data() {
+        return sorted().data();
+    }
+
+    std::size_t advance(std::size_t howmany) {
+        return sorted().advance(howmany);
+    }
+
+    auto take(std::size_t howmany) && {
+        auto vec = std::move(*this).rest();
+        auto k = std::min(howmany, vec.size());
+        std::partial_sort(vec.begin(), vec.begin() + k, vec.end(), compare_);
+        vec.erase(vec.begin() + k, vec.end());
+        return Content(std::move(vec));
+    }
+
+    auto take(std::size_t howmany) & {
+        return self_type(restCopy(), compare_).take(howmany);
+    }
+
+    auto reverse() && {
+        auto compare = reverse_compare(compare_);
+        return LazyIteratorWithSortedContent<T, decltype(compare)>(
+                std::move(*this).rest(), compare
+                );
+    }
+
+    auto reverse() & {
+        return self_type(restCopy(), compare_).reverse();
+    }
+
+    template<class Other>
+    auto sort(Other compare) && {
+        return LazyIteratorWithSortedContent<T, Other>(std::move(*this).rest(), compare);
+    }
+
+    auto sort() && {
+        return std::move(*this).sort(std::less<>());
+    }
+
+    /* in place, as on LazyIteratorWithVectorContent */
+    template<class Other>
+    Content &sort(Other compare) & {
+        return sorted().sort(compare);
+    }
+
+    Content &sort() & {
+        return sorted().sort();
+    }
+
+    /* the rest of the LazyIteratorWithVectorContent API, on the sorted content */
+    template<class Binary>
+    Content &parallelScan(Binary binary, T init, std::size_t nthreads = 0) {
+        return sorted().parallelScan(binary, init, nthreads);
+    }
+
+    template<class Binary>
+    Content &parallelExclusiveScan(Binary binary, T init, std::size_t nthreads = 0) {
+        return sorted().parallelExclusiveScan(binary, init, nthreads);
+    }
+
+    std::size_t saveSnapshot(std::string const &path) {
+        return sorted().saveSnapshot(path);
+    }
+private:
+    /* sorting on first use fills a cache and yields the same elements,
+     * so it is logically const: copies of a const source sort it too
+     */
+    Content &sorted() const {
+        if ( !content_ ) {
+            std::sort(vec_.begin(), vec_.end(), compare_);
+            content_.emplace(std::move(vec_));
+        }
+        return *content_;
+    }
+
+    std::vector<T> rest() && {
+        if ( !content_ ) {
+            return std::move(vec_);
+        }
+        return std::move(*content_).rest();
+    }
+
+    /* the rewrites on an lvalue copy what is left as it is, unsorted or not */
+    std::vector<T> restCopy() const {
+        if ( !content_ ) {
+            return vec_;
+        }
+        return Content(*content_).rest();
+    }
+
+    /* the cache of sorted(): vec_ until the sort, content_ after it */
+    mutable std::vector<T>          vec_;
+    Compare                         compare_;
+    mutable std::optional<Content>  content_;
+};
+
 template<class Generator>
 class LazyIteratorWithGenerator
     : public LazyIteratorBase<LazyIteratorWithGenerator<Generator>>
@@ -207,74 +741,522 @@ private:
     ssize_t         count_;
 };
 
-template<class Iterator, class StopPred>
-class LazyIteratorWithStop
-    : public LazyIteratorBase<LazyIteratorWithStop<Iterator, StopPred>>
+/*
+ * f(i) for i in [beg, end): random access, so advance() and take() are
+ * O(1), and split() makes independent parts for parallel terminals. f
+ * must not depend on the order of the calls.
+ */
+template<class Func>
+class LazyIteratorWithIndex
+    : public LazyIteratorBase<LazyIteratorWithIndex<Func>>
 {
-    using self_type = LazyIteratorWithStop;
+    using self_type = LazyIteratorWithIndex;
 public:
-    using value_type = typename Iterator::value_type;
-    static_assert(std::is_convertible_v<
-            std::result_of_t<StopPred(value_type)>, bool>,
-            "StopPred must return bool-convertible");
+    using value_type = std::decay_t<std::result_of_t<Func const(std::size_t)>>;
 
-    LazyIteratorWithStop(Iterator iter, StopPred pred)
-        : internal_iter_(iter)
-        , stop_pred_(pred)
+    LazyIteratorWithIndex(Func f, std::size_t beg, std::size_t end)
+        : f_(std::move(f))
+        , pos_(beg)
+        , end_(std::max(beg, end))
     {}
 
     self_type &operator++() {
-        must_not_stop();
-        ++internal_iter_;
+        must_ok();
+        ++pos_;
         return *this;
     }
 
     self_type operator++(int) {
-        must_not_stop();
+        must_ok();
         self_type res = *this;
-        ++internal_iter_;
+        ++pos_;
         return res;
     }
 
     value_type operator*() {
-        value_type v = *internal_iter_;
-        if ( stop_pred_(v) ) {
-            throw_stop_iteration();
-        }
-        return v;
+        must_ok();
+        return f_(pos_);
     }
 
     bool ok() {
-        return internal_iter_.ok() && !stop_pred_(*internal_iter_);
+        return pos_ < end_;
     }
-private:
-    void must_not_stop() {
-        if ( stop_pred_(*internal_iter_) ) {
-            throw_stop_iteration();
+
+    std::size_t remaining() {
+        return end_ - pos_;
+    }
+
+    std::size_t advance(std::size_t howmany) {
+        auto step = std::min(howmany, end_ - pos_);
+        pos_ += step;
+        return step;
+    }
+
+    /* the same source over fewer indexes */
+    self_type take(std::size_t howmany) {
+        return self_type(f_, pos_, pos_ + std::min(howmany, end_ - pos_));
+    }
+
+    /* n parts of about the same size, in order; this one is left empty */
+    std::vector<self_type> split(std::size_t n) {
+        n = std::max<std::size_t>(n, 1);
+        std::vector<self_type> parts;
+        auto len = end_ - pos_;
+        for ( std::size_t i = 0; i < n; ++i ) {
+            parts.push_back(self_type(f_, pos_ + len * i / n, pos_ + len * (i + 1) / n));
         }
+        pos_ = end_;
+        return parts;
     }
 
-    Iterator        internal_iter_;
-    StopPred        stop_pred_;
+    static constexpr bool batchable = std::is_arithmetic_v<value_type>;
+
+    std::size_t nextBatch(ColumnBatch<value_type> &out, std::size_t limit) {
+        out.dense = true;
+        out.rows = std::min({limit, ColumnBatch<value_type>::capacity, end_ - pos_});
+        for ( std::size_t i = 0; i < out.rows; ++i ) {
+            out.storage[i] = f_(pos_ + i);
+        }
+        out.values = out.storage;
+        pos_ += out.rows;
+        return out.rows;
+    }
+private:
+    Func            f_;
+    std::size_t     pos_;
+    std::size_t     end_;
 };
 
-template<class Iterator>
-class LazyIteratorWithTake
-    : public LazyIteratorBase<LazyIteratorWithTake<Iterator>>
+/*
+ * Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as
+ * 1, 2, 3"): the counter is encrypted with the key, so the i-th number of
+ * a stream is computed without the previous ones.
+ */
+class Philox4x32
 {
-    using self_type = LazyIteratorWithTake;
 public:
-    using value_type = typename Iterator::value_type;
+    using result_type = std::array<std::uint32_t, 4>;
 
-    LazyIteratorWithTake(Iterator iter, size_t howmany)
-        : internal_iter_(iter)
-        , remain_(howmany)
+    explicit Philox4x32(std::uint64_t seed = 0)
+        : key_{static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32)}
     {}
 
-    self_type &operator++() {
-        must_not_stop();
-        --remain_;
-        ++internal_iter_;
+    result_type operator()(std::uint64_t counter, std::uint64_t stream = 0) const {
+        result_type c = {
+            static_cast<std::uint32_t>(counter), static_cast<std::uint32_t>(counter >> 32),
+            static_cast<std::uint32_t>(stream), static_cast<std::uint32_t>(stream >> 32),
+        };
+        std::uint32_t k0 = key_[0], k1 = key_[1];
+        for ( int round = 0; round < 10; ++round ) {
+            std::uint64_t p0 = std::uint64_t(0xD2511F53) * c[0],
+                          p1 = std::uint64_t(0xCD9E8D57) * c[2];
+            c = {
+                static_cast<std::uint32_t>(p1 >> 32) ^ c[1] ^ k0, static_cast<std::uint32_t>(p1),
+                static_cast<std::uint32_t>(p0 >> 32) ^ c[3] ^ k1, static_cast<std::uint32_t>(p0),
+            };
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+        }
+        return c;
+    }
+
+    /* 64 random bits for counter i */
+    std::uint64_t bits(std::uint64_t i, std::uint64_t stream = 0) const {
+        auto c = (*this)(i, stream);
+        return (std::uint64_t(c[0]) << 32) | c[1];
+    }
+
+    /* in [0, 1), 53 bits */
+    double uniform(std::uint64_t i, std::uint64_t stream = 0) const {
+        return (bits(i, stream) >> 11) * 0x1.0p-53;
+    }
+private:
+    std::uint32_t   key_[2];
+};
+
+/* i -> Philox4x32(seed).uniform(i, stream), for makeLazyIteratorFromIndex() */
+struct PhiloxUniform {
+    Philox4x32      rng;
+    std::uint64_t   stream = 0;
+
+    double operator()(std::size_t i) const {
+        return rng.uniform(i, stream);
+    }
+};
+
+struct PhiloxBits {
+    Philox4x32      rng;
+    std::uint64_t   stream = 0;
+
+    std::uint64_t operator()(std::size_t i) const {
+        return rng.bits(i, stream);
+    }
+};
+
+/*
+ * begin, begin + step, ... before end, for integer types. count(), sum(),
+ * numeric_min(), numeric_max(), advance() and take() are closed forms,
+ * and filter(_1 % k == r) is another stepped range.
+ *
+ * Values are computed modulo 2^bits from the index, so that nothing
+ * overflows past the last one.
+ */
+template<class T>
+class LazyIteratorWithIota
+    : public LazyIteratorBase<LazyIteratorWithIota<T>>
+{
+    static_assert(std::is_integral_v<T>, "iota over integers");
+    using self_type = LazyIteratorWithIota;
+    using U = std::make_unsigned_t<T>;
+    using S = std::make_signed_t<T>;
+public:
+    using value_type = T;
+
+    LazyIteratorWithIota(T begin, T end, S step)
+        : begin_(static_cast<U>(begin))
+        , step_(static_cast<U>(step))
+    {
+        /* the distance fits in U, and so does the magnitude of step */
+        if ( step > 0 && begin < end ) {
+            n_ = steps(U(U(end) - U(begin)), U(step));
+        } else if ( step < 0 && begin > end ) {
+            n_ = steps(U(U(begin) - U(end)), U(U(0) - U(step)));
+        }
+    }
+
+    self_type &operator++() {
+        must_ok();
+        ++pos_;
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        self_type res = *this;
+        ++pos_;
+        return res;
+    }
+
+    value_type operator*() {
+        must_ok();
+        return at(pos_);
+    }
+
+    bool ok() {
+        return pos_ < n_;
+    }
+
+    std::size_t remaining() {
+        return n_ - pos_;
+    }
+
+    std::size_t advance(std::size_t howmany) {
+        auto step = std::min(howmany, n_ - pos_);
+        pos_ += step;
+        return step;
+    }
+
+    self_type take(std::size_t howmany) {
+        return range(at(pos_), step_, std::min(howmany, n_ - pos_));
+    }
+
+    /* n stepped ranges of about the same size, in order; this one is left empty */
+    std::vector<self_type> split(std::size_t n) {
+        n = std::max<std::size_t>(n, 1);
+        std::vector<self_type> parts;
+        auto len = n_ - pos_;
+        for ( std::size_t i = 0; i < n; ++i ) {
+            auto beg = pos_ + len * i / n;
+            parts.push_back(range(at(beg), step_, pos_ + len * (i + 1) / n - beg));
+        }
+        pos_ = n_;
+        return parts;
+    }
+
+    static constexpr bool batchable = true;
+
+    std::size_t nextBatch(ColumnBatch<value_type> &out, std::size_t limit) {
+        out.dense = true;
+        out.rows = std::min({limit, ColumnBatch<value_type>::capacity, n_ - pos_});
+        for ( std::size_t i = 0; i < out.rows; ++i ) {
+            out.storage[i] = at(pos_ + i);
+        }
+        out.values = out.storage;
+        pos_ += out.rows;
+        return out.rows;
+    }
+
+    std::size_t count() {
+        auto n = n_ - pos_;
+        pos_ = n_;
+        return n;
+    }
+
+    /* n * first + step * n * (n - 1) / 2, wrapping like a loop would */
+    value_type sum() {
+        std::uint64_t n = n_ - pos_,
+                      pairs = n % 2 == 0 ? n / 2 * (n - 1) : n * ((n - 1) / 2);
+        std::uint64_t res = n * U(at(pos_)) + step_ * pairs;
+        pos_ = n_;
+        return static_cast<value_type>(U(res));
+    }
+
+    value_type numeric_min() {
+        return extremum(false);
+    }
+
+    value_type numeric_max() {
+        return extremum(true);
+    }
+
+    /* _1 % k == r keeps every (k / gcd(k, step))-th element from the
+     * first that matches, on the side of 0 the sign of r asks for; not
+     * when the conversions of the predicate change x or x % k, as in
+     * int % 3u, where the predicate is tested on each element
+     */
+    template<class Pred>
+    auto filter(Pred pred) {
+        if constexpr ( steppable<Pred>() ) {
+            return stepped(lazy_expr_mod_eq<Pred>::modulus(pred), lazy_expr_mod_eq<Pred>::remainder(pred));
+        } else {
+            return LazyIteratorBase<self_type>::filter(pred);
+        }
+    }
+private:
+    template<class Pred>
+    static constexpr bool steppable() {
+        if constexpr ( lazy_expr_mod_eq<Pred>::value ) {
+            using K = decltype(lazy_expr_mod_eq<Pred>::modulus(std::declval<Pred const &>()));
+            using R = decltype(lazy_expr_mod_eq<Pred>::remainder(std::declval<Pred const &>()));
+            using P = decltype(std::declval<T>() % std::declval<K>());
+            using Q = decltype(std::declval<P>() + std::declval<R>());
+            return !(std::is_signed_v<T> && std::is_unsigned_v<P>)
+                && !(std::is_signed_v<P> && std::is_unsigned_v<Q>);
+        } else {
+            return false;
+        }
+    }
+
+    static std::size_t steps(std::uint64_t distance, std::uint64_t step) {
+        return static_cast<std::size_t>(distance / step + (distance % step != 0));
+    }
+
+    /* n values from first, step modulo 2^bits */
+    static self_type range(T first, U step, std::size_t n) {
+        self_type res(first, first, 1);
+        res.step_ = step;
+        res.n_ = n;
+        return res;
+    }
+
+    T at(std::size_t i) const {
+        return static_cast<T>(U(begin_ + std::uint64_t(i) * step_));
+    }
+
+    S signedStep() const {
+        return static_cast<S>(step_);
+    }
+
+    value_type extremum(bool max) {
+        if ( pos_ == n_ ) {
+            return max ? std::numeric_limits<T>::min() : std::numeric_limits<T>::max();
+        }
+        T first = at(pos_), last = at(n_ - 1);
+        pos_ = n_;
+        return (signedStep() > 0) == max ? last : first;
+    }
+
+    /* x % k == r, in the types the predicate computes them in */
+    template<class K, class R>
+    self_type stepped(K k, R r) {
+        using P = decltype(std::declval<T>() % std::declval<K>());
+        using Q = decltype(std::declval<P>() + std::declval<R>());
+        auto first = pos_, last = n_;
+        pos_ = n_;
+
+        /* x % -k == x % k */
+        std::uint64_t mod = magnitude(static_cast<P>(k)),
+                      rem = magnitude(static_cast<Q>(r));
+        bool negative = isNegative(static_cast<Q>(r));
+        if ( mod == 0 || rem >= mod ) {
+            return range(T(), step_, 0);
+        }
+
+        /* x % k keeps the sign of x: [first, last) narrows to the indexes
+         * of positive values for r > 0, of negative values for r < 0
+         */
+        if ( rem != 0 ) {
+            auto keep = [&] (std::size_t i) { return negative ? isNegative(at(i)) : at(i) > 0; };
+            /* the kept indexes are a suffix or a prefix */
+            bool suffix = !negative == (signedStep() > 0);
+            std::size_t lo = first, hi = last;
+            while ( lo < hi ) {
+                auto mid = lo + (hi - lo) / 2;
+                if ( keep(mid) != suffix ) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            (suffix ? first : last) = lo;
+        }
+        if ( first >= last ) {
+            return range(T(), step_, 0);
+        }
+
+        /* i * step = r - x_first (mod k) */
+        std::uint64_t c = subMod(residue(negative, rem, mod), residue(at(first), mod), mod),
+                      s = residue(signedStep(), mod),
+                      g = gcd(s, mod),
+                      m = mod / g;
+        if ( c % g != 0 ) {
+            return range(T(), step_, 0);
+        }
+        std::uint64_t i0 = m == 1 ? 0 : mulMod(c / g, inverse(s / g, m), m);
+        if ( i0 >= last - first ) {
+            return range(T(), step_, 0);
+        }
+        auto start = first + static_cast<std::size_t>(i0);
+        return range(at(start), U(step_ * m), steps(last - start, m));
+    }
+
+    template<class V>
+    static bool isNegative(V v) {
+        if constexpr ( std::is_signed_v<V> ) {
+            return v < 0;
+        } else {
+            return false;
+        }
+    }
+
+    template<class V>
+    static std::uint64_t magnitude(V v) {
+        auto u = static_cast<std::uint64_t>(v);
+        return isNegative(v) ? 0 - u : u;
+    }
+
+    /* v mod m in [0, m) */
+    template<class V>
+    static std::uint64_t residue(V v, std::uint64_t m) {
+        return residue(isNegative(v), magnitude(v), m);
+    }
+
+    static std::uint64_t residue(bool negative, std::uint64_t magnitude, std::uint64_t m) {
+        auto res = magnitude % m;
+        return negative && res != 0 ? m - res : res;
+    }
+
+    /* a, b < m, without overflowing 64 bits */
+    static std::uint64_t addMod(std::uint64_t a, std::uint64_t b, std::uint64_t m) {
+        return a >= m - b ? a - (m - b) : a + b;
+    }
+
+    static std::uint64_t subMod(std::uint64_t a, std::uint64_t b, std::uint64_t m) {
+        return a >= b ? a - b : a + (m - b);
+    }
+
+    static std::uint64_t mulMod(std::uint64_t a, std::uint64_t b, std::uint64_t m) {
+        std::uint64_t res = 0;
+        for ( ; b != 0; b >>= 1 ) {
+            if ( b & 1 ) res = addMod(res, a, m);
+            a = addMod(a, a, m);
+        }
+        return res;
+    }
+
+    static std::uint64_t gcd(std::uint64_t a, std::uint64_t b) {
+        while ( b != 0 ) {
+            a %= b;
+            std::swap(a, b);
+        }
+        return a;
+    }
+
+    /* a^-1 mod m, a and m coprime, m > 1; the coefficients are kept mod m */
+    static std::uint64_t inverse(std::uint64_t a, std::uint64_t m) {
+        std::uint64_t r0 = m, r1 = a % m, t0 = 0, t1 = 1;
+        while ( r1 != 0 ) {
+            std::uint64_t q = r0 / r1;
+            std::tie(r0, r1) = std::make_pair(r1, r0 - q * r1);
+            std::tie(t0, t1) = std::make_pair(t1, subMod(t0, mulMod(q % m, t1, m), m));
+        }
+        return t0;
+    }
+
+    U               begin_;
+    U               step_;
+    std::size_t     n_ = 0;
+    std::size_t     pos_ = 0;
+};
+
+template<class Iterator, class StopPred>
+class LazyIteratorWithStop
+    : public LazyIteratorBase<LazyIteratorWithStop<Iterator, StopPred>>
+{
+    using self_type = LazyIteratorWithStop;
+public:
+    using value_type = typename Iterator::value_type;
+    static_assert(std::is_convertible_v<
+            std::result_of_t<StopPred(value_type)>, bool>,
+            "StopPred must return bool-convertible");
+
+    LazyIteratorWithStop(Iterator iter, StopPred pred)
+        : internal_iter_(iter)
+        , stop_pred_(pred)
+    {}
+
+    self_type &operator++() {
+        must_not_stop();
+        ++internal_iter_;
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_not_stop();
+        self_type res = *this;
+        ++internal_iter_;
+        return res;
+    }
+
+    value_type operator*() {
+        value_type v = *internal_iter_;
+        if ( stop_pred_(v) ) {
+            throw_stop_iteration();
+        }
+        return v;
+    }
+
+    bool ok() {
+        return internal_iter_.ok() && !stop_pred_(*internal_iter_);
+    }
+private:
+    void must_not_stop() {
+        if ( stop_pred_(*internal_iter_) ) {
+            throw_stop_iteration();
+        }
+    }
+
+    Iterator        internal_iter_;
+    StopPred        stop_pred_;
+};
+
+template<class Iterator>
+class LazyIteratorWithTake
+    : public LazyIteratorBase<LazyIteratorWithTake<Iterator>>
+{
+    using self_type = LazyIteratorWithTake;
+public:
+    using value_type = typename Iterator::value_type;
+
+    LazyIteratorWithTake(Iterator iter, size_t howmany)
+        : internal_iter_(iter)
+        , remain_(howmany)
+    {}
+
+    self_type &operator++() {
+        must_not_stop();
+        --remain_;
+        ++internal_iter_;
         return *this;
     }
 
@@ -294,6 +1276,42 @@ public:
     bool ok() {
         return remain_ > 0 && internal_iter_.ok();
     }
+
+    template<class I = Iterator, class = std::enable_if_t<has_remaining_v<I>>>
+    std::size_t remaining() {
+        return std::min(remain_, internal_iter_.remaining());
+    }
+
+    static constexpr bool batchable = Iterator::batchable;
+
+    /* limiting rows to remain_ may take fewer than remain_ after a filter,
+     * the next batch then takes the rest
+     */
+    std::size_t nextBatch(ColumnBatch<value_type> &out, std::size_t limit) {
+        if ( remain_ == 0 ) {
+            return out.rows = 0;
+        }
+        internal_iter_.nextBatch(out, std::min(limit, remain_));
+        remain_ -= out.size();
+        return out.rows;
+    }
+
+    std::size_t advance(std::size_t howmany) {
+        auto step = internal_iter_.advance(std::min(howmany, remain_));
+        remain_ -= step;
+        return step;
+    }
+
+    /* take(a).take(b) is take(min(a, b)) */
+    auto take(std::size_t howmany) {
+        return self_type(internal_iter_, std::min(howmany, remain_));
+    }
+
+    /* end <= remaining() already keeps within the take */
+    template<class I = Iterator, class = std::enable_if_t<has_view_v<I>>>
+    auto view(std::size_t b, std::size_t e) {
+        return internal_iter_.view(b, e);
+    }
 private:
     void must_not_stop() {
         if ( !remain_ ) {
@@ -336,6 +1354,50 @@ public:
     bool ok() {
         return internal_iter_.ok();
     }
+
+    template<class I = Iterator, class = std::enable_if_t<has_remaining_v<I>>>
+    std::size_t remaining() {
+        return internal_iter_.remaining();
+    }
+
+    static constexpr bool batchable = Iterator::batchable && std::is_arithmetic_v<value_type>;
+
+    /* a tight loop over the batch, only over the selected rows if any */
+    std::size_t nextBatch(ColumnBatch<value_type> &out, std::size_t limit) {
+        ColumnBatch<typename Iterator::value_type> in;
+        out.rows = internal_iter_.nextBatch(in, limit);
+        out.dense = in.dense;
+        if ( in.dense ) {
+            for ( std::size_t i = 0; i < in.rows; ++i ) {
+                out.storage[i] = map_func_(in.values[i]);
+            }
+        } else {
+            out.selected = in.selected;
+            for ( std::size_t j = 0; j < in.selected; ++j ) {
+                auto r = in.sel[j];
+                out.sel[j] = r;
+                out.storage[r] = map_func_(in.values[r]);
+            }
+        }
+        out.values = out.storage;
+        return out.rows;
+    }
+
+    /* map is one to one, skipped elements need not be mapped */
+    std::size_t advance(std::size_t howmany) {
+        return internal_iter_.advance(howmany);
+    }
+
+    /* nor counted ones */
+    std::size_t count() {
+        return internal_iter_.count();
+    }
+
+    template<class I = Iterator, class = std::enable_if_t<has_view_v<I>>>
+    auto view(std::size_t b, std::size_t e) {
+        auto inner = internal_iter_.view(b, e);
+        return LazyIteratorWithMap<decltype(inner), MapFunc>(inner, map_func_);
+    }
 private:
     Iterator        internal_iter_;
     MapFunc         map_func_;
@@ -357,19 +1419,19 @@ public:
         : internal_iter_(iter)
         , filter_func_(func)
     {
-        advance();
+        seek();
     }
 
     self_type &operator++() {
         ++internal_iter_;
-        advance();
+        seek();
         return *this;
     }
 
     self_type operator++(int) {
         self_type res = *this;
         ++internal_iter_;
-        advance();
+        seek();
         return res;
     }
 
@@ -381,57 +1443,1093 @@ public:
         return internal_iter_.ok();
     }
 
+    static constexpr bool batchable = Iterator::batchable;
+
+    /* narrows the selection vector without branching on the predicate */
+    std::size_t nextBatch(ColumnBatch<value_type> &out, std::size_t limit) {
+        internal_iter_.nextBatch(out, limit);
+        std::size_t k = 0;
+        if ( out.dense ) {
+            for ( std::size_t i = 0; i < out.rows; ++i ) {
+                out.sel[k] = static_cast<std::uint16_t>(i);
+                k += static_cast<bool>(filter_func_(out.values[i]));
+            }
+        } else {
+            for ( std::size_t j = 0; j < out.selected; ++j ) {
+                auto r = out.sel[j];
+                out.sel[k] = r;
+                k += static_cast<bool>(filter_func_(out.values[r]));
+            }
+        }
+        out.dense = false;
+        out.selected = k;
+        return out.rows;
+    }
+
 private:
     Iterator        internal_iter_;
     FilterFunc      filter_func_;
 
-    void advance() {
+    void seek() {
         while ( internal_iter_.ok() && !filter_func_(*internal_iter_) ) {
             ++internal_iter_;
         }
     }
 };
 
-template<class Iterator1, class Iterator2, class Zipper>
-class LazyIteratorWithZip
-    : public LazyIteratorBase<LazyIteratorWithZip<Iterator1, Iterator2, Zipper>>
+/*
+ * Preds: value_type -> bool, side effect free
+ *
+ * Keeps the elements passing all of Preds, evaluated cheapest and most
+ * selective first. One element in sample_every is kept aside; once there
+ * are reorder_every of them, each predicate is timed over all of them,
+ * which amortizes the clock, and the predicates are sorted by
+ * cost / (1 - pass rate). Each round uses fresh samples, so the order
+ * follows drifts in the data.
+ */
+template<class Iterator, class... Preds>
+class LazyIteratorWithAdaptiveFilter
+    : public LazyIteratorBase<LazyIteratorWithAdaptiveFilter<Iterator, Preds...>>
 {
-    using self_type = LazyIteratorWithZip;
+    using self_type = LazyIteratorWithAdaptiveFilter;
+    static constexpr std::size_t N = sizeof...(Preds);
+    static constexpr std::size_t sample_every = 64;
+    static constexpr std::size_t reorder_every = 256;
 public:
-    using value_type = std::result_of_t<
-        Zipper(typename Iterator1::value_type, typename Iterator2::value_type)
-        >;
+    using value_type = typename Iterator::value_type;
 
-    LazyIteratorWithZip(Iterator1 iter1, Iterator2 iter2, Zipper zipper)
-        : internal_iter1_(iter1)
-        , internal_iter2_(iter2)
-        , zipper_(zipper)
-    {}
+    LazyIteratorWithAdaptiveFilter(Iterator iter, Preds... preds)
+        : internal_iter_(iter)
+        , preds_(preds...)
+    {
+        std::iota(order_.begin(), order_.end(), 0);
+        samples_.reserve(reorder_every);
+        seek();
+    }
 
     self_type &operator++() {
-        ++internal_iter1_;
-        ++internal_iter2_;
+        ++internal_iter_;
+        seek();
         return *this;
     }
 
     self_type operator++(int) {
         self_type res = *this;
-        ++internal_iter1_;
-        ++internal_iter2_;
+        ++internal_iter_;
+        seek();
         return res;
     }
 
     value_type operator*() {
-        return zipper_(*internal_iter1_, *internal_iter2_);
+        return *internal_iter_;
     }
 
     bool ok() {
-        return internal_iter1_.ok() && internal_iter2_.ok();
+        return internal_iter_.ok();
+    }
+
+    /* indexes of Preds in evaluation order */
+    std::array<std::size_t, N> const &order() const {
+        return order_;
+    }
+private:
+    void seek() {
+        while ( internal_iter_.ok() && !pass(*internal_iter_) ) {
+            ++internal_iter_;
+        }
+    }
+
+    bool pass(value_type const &v) {
+        if ( ++seen_ % sample_every == 0 ) {
+            samples_.push_back(v);
+            if ( samples_.size() == reorder_every ) {
+                reorder();
+            }
+        }
+        for ( auto i : order_ ) {
+            if ( !eval_at(i, v) ) return false;
+        }
+        return true;
+    }
+
+    void reorder() {
+        std::array<double, N> rank;
+        for ( std::size_t i = 0; i < N; ++i ) {
+            std::size_t passed = 0;
+            auto start = std::chrono::steady_clock::now();
+            for ( auto const &v : samples_ ) {
+                passed += eval_at(i, v);
+            }
+            auto stop = std::chrono::steady_clock::now();
+            double cost = std::chrono::duration<double, std::nano>(stop - start).count(),
+                   reject = 1.0 - 1.0 * passed / samples_.size();
+            rank[i] = cost / std::max(reject, 1e-6);
+        }
+        std::stable_sort(order_.begin(), order_.end(),
+                [&rank] (std::size_t a, std::size_t b) { return rank[a] < rank[b]; });
+        samples_.clear();
+    }
+
+    template<std::size_t I = 0>
+    bool eval_at(std::size_t i, value_type const &v) {
+        if constexpr ( I + 1 == N ) {
+            return std::get<I>(preds_)(v);
+        } else {
+            return i == I ? static_cast<bool>(std::get<I>(preds_)(v)) : eval_at<I + 1>(i, v);
+        }
+    }
+
+    Iterator                    internal_iter_;
+    std::tuple<Preds...>        preds_;
+
+    std::array<std::size_t, N>  order_;
+    std::vector<value_type>     samples_;
+    std::size_t                 seen_ = 0;
+};
+
+template<class Iterator1, class Iterator2, class Zipper>
+class LazyIteratorWithZip
+    : public LazyIteratorBase<LazyIteratorWithZip<Iterator1, Iterator2, Zipper>>
+{
+    using self_type = LazyIteratorWithZip;
+public:
+    using value_type = std::result_of_t<
+        Zipper(typename Iterator1::value_type, typename Iterator2::value_type)
+        >;
+
+    LazyIteratorWithZip(Iterator1 iter1, Iterator2 iter2, Zipper zipper)
+        : internal_iter1_(iter1)
+        , internal_iter2_(iter2)
+        , zipper_(zipper)
+    {}
+
+    self_type &operator++() {
+        ++internal_iter1_;
+        ++internal_iter2_;
+        return *this;
+    }
+
+    self_type operator++(int) {
+        self_type res = *this;
+        ++internal_iter1_;
+        ++internal_iter2_;
+        return res;
+    }
+
+    value_type operator*() {
+        return zipper_(*internal_iter1_, *internal_iter2_);
+    }
+
+    bool ok() {
+        return internal_iter1_.ok() && internal_iter2_.ok();
+    }
+
+    template<class I1 = Iterator1, class I2 = Iterator2,
+             class = std::enable_if_t<has_remaining_v<I1> && has_remaining_v<I2>>>
+    std::size_t remaining() {
+        return std::min(internal_iter1_.remaining(), internal_iter2_.remaining());
+    }
+
+    std::size_t advance(std::size_t howmany) {
+        return std::min(internal_iter1_.advance(howmany), internal_iter2_.advance(howmany));
+    }
+
+    template<class I1 = Iterator1, class I2 = Iterator2,
+             class = std::enable_if_t<has_view_v<I1> && has_view_v<I2>>>
+    auto view(std::size_t b, std::size_t e) {
+        auto inner1 = internal_iter1_.view(b, e);
+        auto inner2 = internal_iter2_.view(b, e);
+        return LazyIteratorWithZip<decltype(inner1), decltype(inner2), Zipper>(inner1, inner2, zipper_);
+    }
+
+    /* a placeholder expression over two contiguous iterators is a
+     * zipReduce(), a block at a time without zipped values
+     */
+    template<class Binary, class InitValueType>
+    auto reduce(Binary binary, InitValueType init_value) {
+        if constexpr ( Iterator1::contiguous && Iterator2::contiguous && is_lazy_expr_v<Zipper> ) {
+            static_assert(std::is_convertible_v<
+                    std::result_of_t<Binary(InitValueType, value_type)>, InitValueType>,
+                    "Binary must be InitValueType -> value_type -> InitValueType");
+            auto n = remaining();
+            auto const *p = internal_iter2_.data();
+            auto res = internal_iter1_.zipReduce(
+                    LazyIteratorRaw<std::remove_reference_t<decltype(*p)> *>(p, p + n),
+                    zipper_, binary, init_value);
+            internal_iter2_.advance(n);
+            return res;
+        } else {
+            return LazyIteratorBase<self_type>::reduce(binary, init_value);
+        }
+    }
+private:
+    Iterator1       internal_iter1_;
+    Iterator2       internal_iter2_;
+    Zipper          zipper_;
+};
+
+/*
+ * std::tuple of one element of each iterator, up to the shortest one.
+ *
+ * Elements of contiguous iterators are references into their storage,
+ * valid while that storage lives, the others are copies. When every
+ * iterator is sized, the shortest length is known up front and ok()
+ * tests a single counter; when every iterator is contiguous, moving on
+ * only increments a position, and nextColumns() hands out blocks of all
+ * the columns as Spans, without copying.
+ */
+template<class... Iterators>
+class LazyIteratorWithZipN
+    : public LazyIteratorBase<LazyIteratorWithZipN<Iterators...>>
+{
+    using self_type = LazyIteratorWithZipN;
+    static_assert(sizeof...(Iterators) > 0, "zip at least one iterator");
+
+    template<class I>
+    using element_t = std::conditional_t<I::contiguous,
+                                         typename I::value_type const &,
+                                         typename I::value_type>;
+
+    static constexpr bool all_sized = (has_remaining_v<Iterators> && ...);
+    static constexpr bool all_contiguous = (Iterators::contiguous && ...);
+public:
+    using value_type = std::tuple<element_t<Iterators>...>;
+
+    explicit LazyIteratorWithZipN(Iterators... iters)
+        : internal_iters_(iters...)
+    {
+        if constexpr ( all_sized ) {
+            left_ = std::apply([] (auto &... it) { return std::min({it.remaining()...}); },
+                    internal_iters_);
+        }
+    }
+
+    self_type &operator++() {
+        must_ok();
+        step();
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        self_type res = *this;
+        step();
+        return res;
+    }
+
+    value_type operator*() {
+        must_ok();
+        return std::apply([this] (auto &... it) { return value_type(element(it)...); },
+                internal_iters_);
+    }
+
+    bool ok() {
+        if constexpr ( all_sized ) {
+            return left_ > 0;
+        } else {
+            return std::apply([] (auto &... it) { return (it.ok() && ...); }, internal_iters_);
+        }
+    }
+
+    template<bool S = all_sized, class = std::enable_if_t<S>>
+    std::size_t remaining() {
+        return left_;
+    }
+
+    std::size_t advance(std::size_t howmany) {
+        if constexpr ( all_contiguous ) {
+            auto step = std::min(howmany, left_);
+            pos_ += step;
+            left_ -= step;
+            return step;
+        } else if constexpr ( all_sized ) {
+            auto step = std::min(howmany, left_);
+            std::apply([step] (auto &... it) { (it.advance(step), ...); }, internal_iters_);
+            left_ -= step;
+            return step;
+        } else {
+            return std::apply([howmany] (auto &... it) { return std::min({it.advance(howmany)...}); },
+                    internal_iters_);
+        }
+    }
+
+    /* std::tuple of a Span per column, of up to limit rows, empty at the end */
+    template<bool C = all_contiguous, class = std::enable_if_t<C>>
+    auto nextColumns(std::size_t limit = lazy_expr_batch) {
+        auto rows = std::min(limit, left_);
+        auto columns = std::apply([this, rows] (auto &... it) {
+                return std::make_tuple(column(it, rows)...);
+            }, internal_iters_);
+        pos_ += rows;
+        left_ -= rows;
+        return columns;
+    }
+
+    /*
+     * Kernel: (Span<const Iterators::value_type>...) -> void
+     */
+    template<class Kernel, bool C = all_contiguous, class = std::enable_if_t<C>>
+    void foreachColumns(Kernel kernel, std::size_t n = lazy_expr_batch) {
+        while ( left_ > 0 ) {
+            std::apply(kernel, nextColumns(n));
+        }
+    }
+private:
+    void step() {
+        if constexpr ( all_contiguous ) {
+            ++pos_;
+        } else {
+            std::apply([] (auto &... it) { (++it, ...); }, internal_iters_);
+        }
+        if constexpr ( all_sized ) {
+            --left_;
+        }
+    }
+
+    template<class I>
+    element_t<I> element(I &it) {
+        if constexpr ( I::contiguous ) {
+            return it.data()[all_contiguous ? pos_ : 0];
+        } else {
+            return *it;
+        }
+    }
+
+    template<class I>
+    auto column(I &it, std::size_t rows) {
+        return Span<typename I::value_type const>{it.data() + pos_, rows};
+    }
+
+    std::tuple<Iterators...>    internal_iters_;
+    /* when all contiguous, the iterators stay put and pos_ moves */
+    std::size_t                 pos_ = 0;
+    std::size_t                 left_ = 0;
+};
+
+/*
+ * Binary: (InitValueType, value_type) -> InitValueType
+ *
+ * Inclusive: op(init, e0, ..., ei) at position i
+ * otherwise: op(init, e0, ..., ei-1) at position i
+ */
+template<class Iterator, class Binary, class InitValueType, bool Inclusive>
+class LazyIteratorWithScan
+    : public LazyIteratorBase<LazyIteratorWithScan<Iterator, Binary, InitValueType, Inclusive>>
+{
+    using self_type = LazyIteratorWithScan;
+public:
+    using value_type = InitValueType;
+    static_assert(std::is_convertible_v<
+            std::result_of_t<Binary(InitValueType, typename Iterator::value_type)>,
+            InitValueType>,
+            "Binary must be InitValueType -> value_type -> InitValueType");
+
+    LazyIteratorWithScan(Iterator iter, Binary binary, InitValueType init_value)
+        : internal_iter_(iter)
+        , binary_(binary)
+        , acc_(init_value)
+    {
+        if ( Inclusive && internal_iter_.ok() ) {
+            acc_ = binary_(acc_, *internal_iter_);
+        }
+    }
+
+    self_type &operator++() {
+        must_ok();
+        next();
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        self_type res = *this;
+        next();
+        return res;
+    }
+
+    value_type operator*() {
+        must_ok();
+        return acc_;
+    }
+
+    bool ok() {
+        return internal_iter_.ok();
+    }
+
+    template<class I = Iterator, class = std::enable_if_t<has_remaining_v<I>>>
+    std::size_t remaining() {
+        return internal_iter_.remaining();
+    }
+private:
+    void next() {
+        if constexpr ( Inclusive ) {
+            ++internal_iter_;
+            if ( internal_iter_.ok() ) {
+                acc_ = binary_(acc_, *internal_iter_);
+            }
+        } else {
+            acc_ = binary_(acc_, *internal_iter_);
+            ++internal_iter_;
+        }
+    }
+
+    Iterator        internal_iter_;
+    Binary          binary_;
+    InitValueType   acc_;
+};
+
+/* a lazy iterator owning a container, e.g. the std::vector a flatMap
+ * function returns
+ */
+template<class Range>
+class LazyIteratorWithRangeContent
+    : public LazyIteratorBase<LazyIteratorWithRangeContent<Range>>
+{
+    using self_type = LazyIteratorWithRangeContent;
+    using RangeIterator = decltype(std::begin(std::declval<Range&>()));
+public:
+    using value_type = typename std::iterator_traits<RangeIterator>::value_type;
+
+    explicit LazyIteratorWithRangeContent(Range range)
+        : range_(std::move(range))
+        , cur_(std::begin(range_))
+    {}
+
+    /* cur_ points into range_, rebase on copy and on move, which
+     * need not keep the buffer (std::array, small std::string)
+     */
+    LazyIteratorWithRangeContent(self_type const &other)
+        : LazyIteratorWithRangeContent(Range(other.range_), other.offset())
+    {}
+
+    LazyIteratorWithRangeContent(self_type &&other)
+        : LazyIteratorWithRangeContent(std::move(other.range_), other.offset())
+    {}
+
+    self_type &operator++() {
+        must_ok();
+        ++cur_;
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        self_type res = *this;
+        ++cur_;
+        return res;
+    }
+
+    value_type operator*() {
+        must_ok();
+        return *cur_;
+    }
+
+    bool ok() {
+        return cur_ != std::end(range_);
+    }
+
+    std::size_t remaining() {
+        return std::distance(cur_, std::end(range_));
+    }
+private:
+    std::size_t offset() const {
+        auto &r = const_cast<Range&>(range_);
+        return std::distance(std::begin(r), cur_);
+    }
+
+    LazyIteratorWithRangeContent(Range &&range, std::size_t offset)
+        : range_(std::move(range))
+        , cur_(std::next(std::begin(range_), offset))
+    {}
+
+    Range           range_;
+    RangeIterator   cur_;
+};
+
+/* split delimiters: a byte, any byte of a set, or a string */
+struct SplitByte {
+    char    c;
+
+    char const *find(char const *p, char const *end) const {
+        return kernel_find_byte(p, end, c);
+    }
+
+    std::size_t occurrences(char const *p, char const *end) const {
+        return kernel_count_byte(p, end, c);
+    }
+
+    std::size_t size() const {
+        return 1;
+    }
+};
+
+struct SplitAnyOf {
+    std::string     set;
+
+    char const *find(char const *p, char const *end) const {
+        return kernel_find_any_byte(p, end, set.data(), set.size());
+    }
+
+    std::size_t size() const {
+        return 1;
+    }
+};
+
+/* an empty string never matches */
+struct SplitString {
+    std::string     delim;
+
+    char const *find(char const *p, char const *end) const {
+        return kernel_find_bytes(p, end, delim.data(), delim.size());
+    }
+
+    std::size_t size() const {
+        return delim.size();
+    }
+};
+
+/* for makeLazyIteratorFromSplit(text, splitAnyOf(" \t\n")) */
+inline SplitAnyOf
+splitAnyOf(std::string_view set)
+{
+    return {std::string(set)};
+}
+
+/*
+ * The tokens of a text between delimiters, as std::string_views into the
+ * text, which must outlive them. n delimiters make n + 1 tokens, some of
+ * them maybe empty.
+ *
+ * Delim concept:
+ *  char const *find(char const *p, char const *end) const;  or end
+ *  std::size_t size() const;   bytes of a match
+ */
+template<class Delim>
+class LazyIteratorWithSplit
+    : public LazyIteratorBase<LazyIteratorWithSplit<Delim>>
+{
+    using self_type = LazyIteratorWithSplit;
+public:
+    using value_type = std::string_view;
+
+    LazyIteratorWithSplit(std::string_view text, Delim delim)
+        : delim_(std::move(delim))
+        , pos_(text.data())
+        , end_(text.data() + text.size())
+        , next_(delim_.find(pos_, end_))
+    {}
+
+    self_type &operator++() {
+        must_ok();
+        seek();
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        self_type res = *this;
+        seek();
+        return res;
+    }
+
+    value_type operator*() {
+        must_ok();
+        return std::string_view(pos_, next_ - pos_);
+    }
+
+    bool ok() {
+        return !done_;
+    }
+
+    /* counts delimiters without making the tokens */
+    std::size_t count() {
+        if ( done_ ) return 0;
+        done_ = true;
+        if constexpr ( std::is_same_v<Delim, SplitByte> ) {
+            return next_ == end_ ? 1 : 2 + delim_.occurrences(next_ + 1, end_);
+        } else {
+            std::size_t n = 1;
+            for ( auto p = next_; p != end_; p = delim_.find(p + delim_.size(), end_) ) {
+                ++n;
+            }
+            return n;
+        }
+    }
+private:
+    void seek() {
+        if ( next_ == end_ ) {
+            done_ = true;
+            return;
+        }
+        pos_ = next_ + delim_.size();
+        next_ = delim_.find(pos_, end_);
+    }
+
+    Delim           delim_;
+    char const      *pos_;
+    char const      *end_;
+    /* the delimiter ending the current token, or end_ */
+    char const      *next_;
+    bool            done_ = false;
+};
+
+template<class Range>
+struct static_range_size {};
+
+template<class T, std::size_t N>
+struct static_range_size<std::array<T, N>>
+    : std::integral_constant<std::size_t, N> {};
+
+/*
+ * Func: value_type -> lazy iterator, or value_type -> container
+ *
+ * The current inner iterator lives inline in the stage, one per outer
+ * element, without heap allocation. The element passed to Func is a
+ * temporary: to iterate over a part of it, return the container itself,
+ * which the stage then owns.
+ */
+template<class Iterator, class Func>
+class LazyIteratorWithFlatMap
+    : public LazyIteratorBase<LazyIteratorWithFlatMap<Iterator, Func>>
+{
+    using self_type = LazyIteratorWithFlatMap;
+    using Result = std::decay_t<std::result_of_t<Func(typename Iterator::value_type)>>;
+    using Inner = std::conditional_t<is_lazy_iterator_v<Result>,
+                                     Result, LazyIteratorWithRangeContent<Result>>;
+public:
+    using value_type = typename Inner::value_type;
+
+    LazyIteratorWithFlatMap(Iterator iter, Func func)
+        : internal_iter_(iter)
+        , func_(func)
+    {
+        advance_inner();
+    }
+
+    self_type &operator++() {
+        must_ok();
+        ++*inner_;
+        advance_inner();
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        self_type res = *this;
+        ++*inner_;
+        advance_inner();
+        return res;
+    }
+
+    value_type operator*() {
+        must_ok();
+        return **inner_;
+    }
+
+    bool ok() {
+        return inner_ && inner_->ok();
+    }
+
+    /* known only when every inner range has the same static size */
+    template<class I = Iterator, class R = Result,
+             class = std::enable_if_t<has_remaining_v<I>>,
+             std::size_t N = static_range_size<R>::value>
+    std::size_t remaining() {
+        return (inner_ ? inner_->remaining() : 0) + N * internal_iter_.remaining();
+    }
+private:
+    void advance_inner() {
+        while ( !inner_ || !inner_->ok() ) {
+            if ( !internal_iter_.ok() ) {
+                inner_.reset();
+                return;
+            }
+            inner_.emplace(func_(*internal_iter_));
+            ++internal_iter_;
+        }
+    }
+
+    Iterator                internal_iter_;
+    Func                    func_;
+    std::optional<Inner>    inner_;
+};
+
+/* the elements of each iterator in turn */
+template<class... Iterators>
+class LazyIteratorWithConcat
+    : public LazyIteratorBase<LazyIteratorWithConcat<Iterators...>>
+{
+    using self_type = LazyIteratorWithConcat;
+    static constexpr std::size_t N = sizeof...(Iterators);
+public:
+    using value_type = std::common_type_t<typename Iterators::value_type...>;
+
+    explicit LazyIteratorWithConcat(Iterators... iters)
+        : iters_(iters...)
+    {
+        skip_empty();
+    }
+
+    self_type &operator++() {
+        must_ok();
+        visit([] (auto &it) { ++it; });
+        skip_empty();
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        self_type res = *this;
+        visit([] (auto &it) { ++it; });
+        skip_empty();
+        return res;
+    }
+
+    value_type operator*() {
+        must_ok();
+        return visit([] (auto &it) -> value_type { return *it; });
+    }
+
+    bool ok() {
+        return active_ < N;
+    }
+
+    template<bool Sized = (has_remaining_v<Iterators> && ...),
+             class = std::enable_if_t<Sized>>
+    std::size_t remaining() {
+        std::size_t total = 0;
+        for ( auto i = active_; i < N; ++i ) {
+            total += visit_at(i, [] (auto &it) { return it.remaining(); });
+        }
+        return total;
+    }
+
+    std::size_t advance(std::size_t howmany) {
+        std::size_t step = 0;
+        while ( step < howmany && ok() ) {
+            step += visit([&] (auto &it) { return it.advance(howmany - step); });
+            skip_empty();
+        }
+        return step;
+    }
+private:
+    void skip_empty() {
+        while ( active_ < N && !visit([] (auto &it) { return it.ok(); }) ) {
+            ++active_;
+        }
+    }
+
+    template<class F>
+    decltype(auto) visit(F f) {
+        return visit_at(active_, f);
+    }
+
+    template<std::size_t I = 0, class F>
+    decltype(auto) visit_at(std::size_t i, F f) {
+        if constexpr ( I + 1 == N ) {
+            return f(std::get<I>(iters_));
+        } else {
+            if ( i == I ) {
+                return f(std::get<I>(iters_));
+            }
+            return visit_at<I + 1>(i, f);
+        }
+    }
+
+    std::tuple<Iterators...>    iters_;
+    std::size_t                 active_ = 0;
+};
+
+/*
+ * Span<const value_type> of up to n elements at a time. Contiguous inputs
+ * are viewed in place, other inputs are copied into one buffer, reused
+ * for every batch.
+ */
+template<class Iterator>
+class LazyIteratorWithBatch
+    : public LazyIteratorBase<LazyIteratorWithBatch<Iterator>>
+{
+    using self_type = LazyIteratorWithBatch;
+    using element_type = typename Iterator::value_type;
+    static constexpr bool in_place = Iterator::contiguous;
+public:
+    using value_type = Span<element_type const>;
+
+    LazyIteratorWithBatch(Iterator iter, std::size_t n)
+        : internal_iter_(iter)
+        , n_(std::max<std::size_t>(n, 1))
+    {
+        if constexpr ( !in_place ) {
+            buffer_.reserve(n_);
+        }
+        fill();
+    }
+
+    self_type &operator++() {
+        must_ok();
+        next();
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        self_type res = *this;
+        next();
+        return res;
+    }
+
+    /* recomputed from len_, so a copy of the stage views its own buffer */
+    value_type operator*() {
+        must_ok();
+        if constexpr ( in_place ) {
+            return {internal_iter_.data(), len_};
+        } else {
+            return {buffer_.data(), len_};
+        }
+    }
+
+    bool ok() {
+        return len_ != 0;
+    }
+
+    template<class I = Iterator, class = std::enable_if_t<has_remaining_v<I>>>
+    std::size_t remaining() {
+        auto rest = (internal_iter_.remaining() + n_ - 1) / n_;
+        return in_place ? rest : rest + (len_ != 0);
+    }
+private:
+    void next() {
+        if constexpr ( in_place ) {
+            internal_iter_.advance(len_);
+        }
+        fill();
+    }
+
+    void fill() {
+        if constexpr ( in_place ) {
+            len_ = std::min(n_, internal_iter_.remaining());
+        } else {
+            buffer_.clear();
+            while ( buffer_.size() < n_ && internal_iter_.ok() ) {
+                buffer_.push_back(*internal_iter_);
+                ++internal_iter_;
+            }
+            len_ = buffer_.size();
+        }
+    }
+
+    Iterator                    internal_iter_;
+    std::size_t                 n_;
+    std::size_t                 len_ = 0;
+    std::vector<element_type>   buffer_;
+};
+
+/* keeps each element with probability p, jumping over the rejected ones
+ * with Iterator::advance() instead of drawing a random number for each
+ */
+template<class Iterator>
+class LazyIteratorWithBernoulli
+    : public LazyIteratorBase<LazyIteratorWithBernoulli<Iterator>>
+{
+    using self_type = LazyIteratorWithBernoulli;
+public:
+    using value_type = typename Iterator::value_type;
+
+    LazyIteratorWithBernoulli(Iterator iter, double p, std::uint64_t seed)
+        : internal_iter_(iter)
+        , rng_(seed)
+        /* geometric_distribution needs 0 < p < 1, even when it is not used */
+        , skip_(std::min(std::nextafter(1.0, 0.0), std::max(p, std::numeric_limits<double>::min())))
+        , keep_all_(p >= 1.0)
+        , keep_none_(p <= 0.0)
+    {
+        advance_skip();
+    }
+
+    self_type &operator++() {
+        must_ok();
+        ++internal_iter_;
+        advance_skip();
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        self_type res = *this;
+        ++internal_iter_;
+        advance_skip();
+        return res;
+    }
+
+    value_type operator*() {
+        return *internal_iter_;
+    }
+
+    bool ok() {
+        return internal_iter_.ok();
     }
 private:
-    Iterator1       internal_iter1_;
-    Iterator2       internal_iter2_;
-    Zipper          zipper_;
+    void advance_skip() {
+        if ( keep_all_ ) return;
+        internal_iter_.advance(keep_none_
+                ? std::numeric_limits<std::size_t>::max()
+                : skip_(rng_));
+    }
+
+    Iterator                                        internal_iter_;
+    std::mt19937_64                                 rng_;
+    /* number of failures before the first success */
+    std::geometric_distribution<std::size_t>        skip_;
+    bool                                            keep_all_;
+    bool                                            keep_none_;
+};
+
+/*
+ * Op: (value_type, value_type) -> value_type, associative
+ *
+ * Aggregates the last n elements, one value per full window. The window
+ * is a ring buffer split into a front part, which keeps suffix
+ * aggregates, and a back part, which keeps one running aggregate
+ * (two-stacks). Evicting from an empty front part turns the whole window
+ * into front part, so every element is combined O(1) times amortized.
+ */
+template<class Iterator, class Op>
+class LazyIteratorWithSlidingWindow
+    : public LazyIteratorBase<LazyIteratorWithSlidingWindow<Iterator, Op>>
+{
+    using self_type = LazyIteratorWithSlidingWindow;
+public:
+    using value_type = typename Iterator::value_type;
+    static_assert(std::is_convertible_v<
+            std::result_of_t<Op(value_type, value_type)>, value_type>,
+            "Op must be value_type -> value_type -> value_type");
+
+    LazyIteratorWithSlidingWindow(Iterator iter, std::size_t n, Op op)
+        : internal_iter_(iter)
+        , op_(op)
+        , n_(std::max<std::size_t>(n, 1))
+        , vals_(n_)
+        , aggs_(n_)
+    {
+        while ( size_ < n_ && internal_iter_.ok() ) {
+            push(*internal_iter_);
+            ++internal_iter_;
+        }
+        cached_ = size_ == n_;
+    }
+
+    self_type &operator++() {
+        must_ok();
+        slide();
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        self_type res = *this;
+        slide();
+        return res;
+    }
+
+    value_type operator*() {
+        must_ok();
+        if ( front_ == 0 ) return back_agg_;
+        if ( front_ == size_ ) return aggs_[head_];
+        return op_(aggs_[head_], back_agg_);
+    }
+
+    bool ok() {
+        return cached_;
+    }
+private:
+    std::size_t wrap(std::size_t i) const {
+        return i >= n_ ? i - n_ : i;
+    }
+
+    void slide() {
+        if ( !internal_iter_.ok() ) {
+            cached_ = false;
+            return;
+        }
+        pop();
+        push(*internal_iter_);
+        ++internal_iter_;
+    }
+
+    void push(value_type const &v) {
+        vals_[wrap(head_ + size_)] = v;
+        back_agg_ = size_ == front_ ? v : op_(back_agg_, v);
+        ++size_;
+    }
+
+    void pop() {
+        if ( front_ == 0 ) {
+            flip();
+        }
+        head_ = wrap(head_ + 1);
+        --front_;
+        --size_;
+    }
+
+    void flip() {
+        auto last = wrap(head_ + size_ - 1);
+        aggs_[last] = vals_[last];
+        for ( std::size_t j = size_ - 1; j-- > 0; ) {
+            auto cur = wrap(head_ + j);
+            aggs_[cur] = op_(vals_[cur], aggs_[wrap(cur + 1)]);
+        }
+        front_ = size_;
+    }
+
+    Iterator                    internal_iter_;
+    Op                          op_;
+    std::size_t                 n_;
+
+    std::vector<value_type>     vals_;
+    /* aggs_[i] = op(vals_[i], ..., last value of the front part) */
+    std::vector<value_type>     aggs_;
+    value_type                  back_agg_{};
+    std::size_t                 head_ = 0;
+    std::size_t                 size_ = 0;
+    std::size_t                 front_ = 0;
+    bool                        cached_ = false;
+};
+
+template<class Iterator>
+class SlidingWindow
+{
+public:
+    using value_type = typename Iterator::value_type;
+
+    SlidingWindow(Iterator iter, std::size_t n)
+        : iter_(iter)
+        , n_(n)
+    {}
+
+    template<class Op>
+    auto aggregate(Op op) {
+        return LazyIteratorWithSlidingWindow<Iterator, Op>(iter_, n_, op);
+    }
+
+    auto sum() {
+        return aggregate([] (auto const &a, auto const &b) { return a + b; });
+    }
+
+    auto numeric_min() {
+        return aggregate([] (auto const &a, auto const &b) { return a < b ? a : b; });
+    }
+
+    auto numeric_max() {
+        return aggregate([] (auto const &a, auto const &b) { return a > b ? a : b; });
+    }
+
+    auto mean() {
+        double n = static_cast<double>(std::max<std::size_t>(n_, 1));
+        return sum().map([n] (auto const &e) { return e / n; });
+    }
+private:
+    Iterator        iter_;
+    std::size_t     n_;
 };
 
 /* Joiner: bool (&After, value_type)
@@ -451,13 +2549,133 @@ public:
         : internal_iter_(iter)
         , joiner_(joiner)
     {
-        advance();
+        seek();
+    }
+
+    self_type &operator++() {
+        must_ok();
+        cached_ = false;
+        seek();
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        auto res = *this;
+        cached_ = false;
+        seek();
+        return res;
+    }
+
+    AfterType operator*() {
+        must_ok();
+        return after_;
+    }
+
+    bool ok() {
+        return cached_;
+    }
+private:
+    Iterator        internal_iter_;
+    Joiner          joiner_;
+
+    AfterType       after_;
+    bool            cached_ = false;
+
+    // after seek, internal_iter_ always points to the next position after cached_
+    void seek() {
+        if ( !internal_iter_.ok() ) return;
+
+        cached_ = true;
+        after_ = AfterType();
+        while ( internal_iter_.ok() && joiner_(after_, *internal_iter_) ) {
+            ++internal_iter_;
+        }
+    }
+};
+
+template<class Time, class AfterType>
+struct TimeWindow {
+    Time            begin{};
+    Time            end{};
+    std::size_t     count = 0;
+    AfterType       value{};
+    friend std::ostream &operator<<(std::ostream &os, TimeWindow const &tw) {
+        os << "[" << tw.begin << "~" << tw.end << "]:" << tw.count << ":" << tw.value;
+        return os;
+    }
+};
+
+/* windows [k * width, (k + 1) * width) */
+template<class Time>
+struct TumblingBoundary {
+    Time width;
+
+    template<class Window>
+    void open(Window &w, Time ts) const {
+        if constexpr ( std::is_floating_point_v<Time> ) {
+            w.begin = std::floor(ts / width) * width;
+        } else {
+            w.begin = ts - ((ts % width) + width) % width;
+        }
+        w.end = w.begin + width;
+    }
+
+    template<class Window>
+    bool extend(Window &w, Time ts) const {
+        return !(ts < w.begin) && ts < w.end;
+    }
+};
+
+/* a window closes after a silence longer than gap, end is the last stamp */
+template<class Time>
+struct SessionBoundary {
+    Time gap;
+
+    template<class Window>
+    void open(Window &w, Time ts) const {
+        w.begin = w.end = ts;
+    }
+
+    template<class Window>
+    bool extend(Window &w, Time ts) const {
+        if ( ts < w.end ) return !(ts < w.begin);
+        if ( ts - w.end > gap ) return false;
+        w.end = ts;
+        return true;
+    }
+};
+
+/*
+ * Stamp: value_type -> Time, nondecreasing along the stream
+ * Accumulator: void (&AfterType, value_type const &)
+ * Boundary: TumblingBoundary / SessionBoundary
+ *
+ * Like LazyIteratorWithJoin, one TimeWindow<Time, AfterType> per window,
+ * but the window is kept in place and operator* does not copy it.
+ */
+template<class Iterator, class Stamp, class Accumulator, class AfterType, class Boundary>
+class LazyIteratorWithTimeWindow
+    : public LazyIteratorBase<LazyIteratorWithTimeWindow<Iterator, Stamp, Accumulator, AfterType, Boundary>>
+{
+    using self_type = LazyIteratorWithTimeWindow;
+public:
+    using time_type = std::decay_t<std::result_of_t<Stamp(typename Iterator::value_type)>>;
+    using value_type = TimeWindow<time_type, AfterType>;
+
+    LazyIteratorWithTimeWindow(Iterator iter, Stamp stamp, Accumulator acc, Boundary boundary)
+        : internal_iter_(iter)
+        , stamp_(stamp)
+        , acc_(acc)
+        , boundary_(boundary)
+    {
+        seek();
     }
 
     self_type &operator++() {
         must_ok();
         cached_ = false;
-        advance();
+        seek();
         return *this;
     }
 
@@ -465,65 +2683,451 @@ public:
         must_ok();
         auto res = *this;
         cached_ = false;
-        advance();
+        seek();
+        return res;
+    }
+
+    value_type operator*() {
+        must_ok();
+        return window_;
+    }
+
+    bool ok() {
+        return cached_;
+    }
+private:
+    void seek() {
+        if ( !internal_iter_.ok() ) return;
+
+        cached_ = true;
+        auto v = *internal_iter_;
+        window_.count = 0;
+        window_.value = AfterType();
+        boundary_.open(window_, stamp_(v));
+        for ( ;; ) {
+            acc_(window_.value, v);
+            ++window_.count;
+            ++internal_iter_;
+            if ( !internal_iter_.ok() ) break;
+            v = *internal_iter_;
+            if ( !boundary_.extend(window_, stamp_(v)) ) break;
+        }
+    }
+
+    Iterator        internal_iter_;
+    Stamp           stamp_;
+    Accumulator     acc_;
+    Boundary        boundary_;
+
+    value_type      window_;
+    bool            cached_ = false;
+};
+
+template<class T>
+struct TWithCount {
+    T               t;
+    std::size_t     count = 0;
+    friend std::ostream &operator<<(std::ostream &os, TWithCount const &tg) {
+        os << "[" << tg.t << ":" << tg.count << "]";
+        return os;
+    }
+    friend void lazyFormat(lazy_dependent_t<BufferedWriter, T> &w, TWithCount const &tg) {
+        lazyFormat(w, tg.t);
+        w.put('\t');
+        w.number(tg.count);
+    }
+};
+
+template<class T>
+bool
+tWithCountJoiner(TWithCount<T> &tw, T const &t)
+{
+    if ( tw.count == 0 || tw.t == t ) {
+        if ( tw.count == 0 ) {
+            tw.t = t;
+        }
+        ++tw.count;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+/*
+ * done() with each block of block_rows elements encoded the smallest way of:
+ *  frame of reference  value - min of the block, bit packed
+ *  run length          the values of runs of equal elements and their
+ *                      lengths, both bit packed
+ * integers as themselves, strings through a dictionary of the distinct
+ * ones of the block, by code.
+ *
+ * A block is decoded when the iterator reads into it; advance() and
+ * count() skip blocks whole, sum(), numeric_min(), numeric_max() and
+ * groupSame() work on the packed values and runs. Copies share the blocks.
+ */
+template<class T>
+class LazyIteratorWithCompressedContent
+    : public LazyIteratorBase<LazyIteratorWithCompressedContent<T>>
+{
+    static_assert((std::is_integral_v<T> && !std::is_same_v<T, bool>) || std::is_same_v<T, std::string>,
+            "compressed content of integers or strings");
+    using self_type = LazyIteratorWithCompressedContent;
+
+    struct Block {
+        std::size_t         rows = 0;
+        std::size_t         runs = 0;       /* 0: frame of reference */
+        unsigned            bits = 0;       /* of values - base, 64: not packed */
+        unsigned            len_bits = 0;   /* of run lengths - 1 */
+        std::uint64_t       base = 0;       /* the smallest value */
+        std::uint64_t       top = 0;        /* the largest */
+        std::size_t         values = 0;     /* offsets in Store::bytes */
+        std::size_t         lengths = 0;
+        std::vector<T>      dict;           /* strings: by code */
+    };
+
+    struct Store {
+        std::vector<Block>  blocks;
+        std::vector<char>   bytes;
+        std::size_t         rows = 0;
+    };
+public:
+    using value_type = T;
+
+    template<class Iterator>
+    LazyIteratorWithCompressedContent(Iterator &iter, std::size_t block_rows) {
+        block_rows = std::max<std::size_t>(block_rows, 1);
+        auto store = std::make_shared<Store>();
+        std::vector<T> rows;
+        rows.reserve(block_rows);
+        while ( iter.ok() ) {
+            rows.push_back(*iter);
+            ++iter;
+            if ( rows.size() == block_rows ) {
+                encode(*store, rows);
+                rows.clear();
+            }
+        }
+        if ( !rows.empty() ) {
+            encode(*store, rows);
+        }
+        left_ = store->rows;
+        store_ = std::move(store);
+    }
+
+    self_type &operator++() {
+        must_ok();
+        --left_;
+        if ( ++row_ == store_->blocks[block_].rows ) {
+            nextBlock();
+        }
+        return *this;
+    }
+
+    self_type operator++(int) {
+        must_ok();
+        self_type res = *this;
+        ++*this;
         return res;
     }
 
-    AfterType operator*() {
-        must_ok();
-        return after_;
+    value_type operator*() {
+        must_ok();
+        decode();
+        return buf_[row_];
+    }
+
+    bool ok() {
+        return left_ > 0;
+    }
+
+    std::size_t remaining() {
+        return left_;
+    }
+
+    std::size_t advance(std::size_t howmany) {
+        auto step = std::min(howmany, left_);
+        left_ -= step;
+        for ( auto n = step; n > 0; ) {
+            auto rest = store_->blocks[block_].rows - row_;
+            if ( n < rest ) {
+                row_ += n;
+                break;
+            }
+            n -= rest;
+            nextBlock();
+        }
+        return step;
+    }
+
+    std::size_t count() {
+        return advance(left_);
+    }
+
+    /* bytes of packed values and dictionaries */
+    std::size_t encodedBytes() const {
+        std::size_t n = store_->bytes.size();
+        if constexpr ( std::is_same_v<T, std::string> ) {
+            for ( auto const &b : store_->blocks ) {
+                for ( auto const &s : b.dict ) n += s.size();
+            }
+        }
+        return n;
+    }
+
+    /* rows * min + the packed values, or value * length over the runs */
+    value_type sum() {
+        if constexpr ( std::is_integral_v<T> ) {
+            using U = std::make_unsigned_t<T>;
+            U acc = 0;
+            consume([&acc] (T const *v, std::size_t n) {
+                for ( std::size_t i = 0; i < n; ++i ) acc += U(v[i]);
+            }, [this, &acc] (Block const &b) {
+                U low = U(kernel_from_ordered_bits<T>(b.base));
+                if ( b.runs == 0 ) {
+                    acc += U(b.rows) * low + U(packedSum(b.values, b.rows, b.bits));
+                    return;
+                }
+                runs(b, [&acc, low] (std::uint64_t v, std::size_t len) { acc += U(len) * U(low + U(v)); });
+            });
+            return static_cast<T>(acc);
+        } else {
+            return LazyIteratorBase<self_type>::sum();
+        }
+    }
+
+    value_type numeric_min() {
+        return extremum(false);
+    }
+
+    value_type numeric_max() {
+        return extremum(true);
+    }
+
+    /* from the runs, merged across blocks; strings compared once a run */
+    auto groupSame() {
+        std::vector<TWithCount<T>> groups;
+        auto add = [&groups] (T const &t, std::size_t n) {
+            if ( !groups.empty() && groups.back().t == t ) {
+                groups.back().count += n;
+            } else {
+                groups.push_back({t, n});
+            }
+        };
+        consume([&add] (T const *v, std::size_t n) {
+            for ( std::size_t i = 0; i < n; ++i ) add(v[i], 1);
+        }, [this, &add] (Block const &b) {
+            if ( b.runs ) {
+                runs(b, [&] (std::uint64_t v, std::size_t len) { add(valueOf(b, b.base + v), len); });
+                return;
+            }
+            std::vector<std::uint64_t> keys(b.rows);
+            unpack(b.values, b.rows, b.bits, b.base, keys.data());
+            for ( std::size_t i = 0, j; i < b.rows; i = j ) {
+                for ( j = i + 1; j < b.rows && keys[j] == keys[i]; ++j );
+                add(valueOf(b, keys[i]), j - i);
+            }
+        });
+        return LazyIteratorWithVectorContent<TWithCount<T>>(std::move(groups));
+    }
+private:
+    static void encode(Store &store, std::vector<T> const &rows) {
+        Block b;
+        b.rows = rows.size();
+        std::vector<std::uint64_t> keys(b.rows);
+        if constexpr ( std::is_integral_v<T> ) {
+            for ( std::size_t i = 0; i < b.rows; ++i ) {
+                keys[i] = kernel_ordered_bits(rows[i]);
+            }
+        } else {
+            std::unordered_map<std::string_view, std::uint64_t> codes;
+            for ( std::size_t i = 0; i < b.rows; ++i ) {
+                auto ins = codes.emplace(rows[i], b.dict.size());
+                if ( ins.second ) b.dict.push_back(rows[i]);
+                keys[i] = ins.first->second;
+            }
+        }
+        auto [lo, hi] = std::minmax_element(keys.begin(), keys.end());
+        b.base = *lo;
+        b.top = *hi;
+        b.bits = kernel_bits_for(b.top - b.base);
+        if ( b.bits > 56 ) {
+            b.bits = 64;
+        }
+
+        std::vector<std::uint64_t> values, lengths;
+        std::uint64_t longest = 0;
+        for ( std::size_t i = 0; i < b.rows; ++i ) {
+            keys[i] -= b.base;
+            if ( i == 0 || keys[i] != keys[i - 1] ) {
+                values.push_back(keys[i]);
+                lengths.push_back(0);
+            } else {
+                longest = std::max(longest, ++lengths.back());
+            }
+        }
+        unsigned len_bits = kernel_bits_for(longest);
+        if ( b.bits <= 56 && values.size() * (b.bits + len_bits) < b.rows * b.bits ) {
+            b.runs = values.size();
+            b.len_bits = len_bits;
+            b.values = pack(store, values, b.bits);
+            b.lengths = pack(store, lengths, len_bits);
+        } else {
+            b.values = pack(store, keys, b.bits);
+        }
+        store.rows += b.rows;
+        store.blocks.push_back(std::move(b));
+    }
+
+    /* at the end of the bytes, followed by the 8 bytes kernel_bitpack() needs */
+    static std::size_t pack(Store &store, std::vector<std::uint64_t> const &v, unsigned bits) {
+        auto offset = store.bytes.size();
+        if ( bits == 64 ) {
+            store.bytes.resize(offset + v.size() * 8);
+            std::memcpy(store.bytes.data() + offset, v.data(), v.size() * 8);
+        } else {
+            store.bytes.resize(offset + (v.size() * bits + 7) / 8 + 8);
+            kernel_bitpack(v.data(), v.size(), bits, store.bytes.data() + offset);
+        }
+        return offset;
+    }
+
+    void unpack(std::size_t offset, std::size_t n, unsigned bits, std::uint64_t base, std::uint64_t *out) const {
+        char const *in = store_->bytes.data() + offset;
+        if ( bits == 64 ) {
+            std::memcpy(out, in, n * 8);
+            for ( std::size_t i = 0; i < n; ++i ) out[i] += base;
+        } else {
+            kernel_bitunpack(in, n, bits, base, out);
+        }
     }
 
-    bool ok() {
-        return cached_;
+    std::uint64_t packedSum(std::size_t offset, std::size_t n, unsigned bits) const {
+        if ( bits == 64 ) {
+            std::vector<std::uint64_t> v(n);
+            unpack(offset, n, bits, 0, v.data());
+            return std::accumulate(v.begin(), v.end(), std::uint64_t(0));
+        }
+        return kernel_bitpacked_sum(store_->bytes.data() + offset, n, bits);
     }
-private:
-    Iterator        internal_iter_;
-    Joiner          joiner_;
 
-    AfterType       after_;
-    bool            cached_ = false;
+    /* f(value - base, length) for each run of b */
+    template<class Func>
+    void runs(Block const &b, Func f) const {
+        std::vector<std::uint64_t> values(b.runs), lengths(b.runs);
+        unpack(b.values, b.runs, b.bits, 0, values.data());
+        unpack(b.lengths, b.runs, b.len_bits, 1, lengths.data());
+        for ( std::size_t r = 0; r < b.runs; ++r ) {
+            f(values[r], static_cast<std::size_t>(lengths[r]));
+        }
+    }
 
-    // after advance, internal_iter_ always points to the next position after cached_
-    void advance() {
-        if ( !internal_iter_.ok() ) return;
+    static decltype(auto) valueOf(Block const &b, std::uint64_t key) {
+        if constexpr ( std::is_integral_v<T> ) {
+            return kernel_from_ordered_bits<T>(key);
+        } else {
+            return (b.dict[key]);
+        }
+    }
 
-        cached_ = true;
-        after_ = AfterType();
-        while ( internal_iter_.ok() && joiner_(after_, *internal_iter_) ) {
-            ++internal_iter_;
+    void decode() {
+        if ( decoded_ ) return;
+        auto const &b = store_->blocks[block_];
+        std::vector<std::uint64_t> keys(b.rows);
+        if ( b.runs == 0 ) {
+            unpack(b.values, b.rows, b.bits, b.base, keys.data());
+        } else {
+            auto out = keys.begin();
+            runs(b, [&] (std::uint64_t v, std::size_t len) { out = std::fill_n(out, len, b.base + v); });
+        }
+        buf_.resize(b.rows);
+        for ( std::size_t i = 0; i < b.rows; ++i ) {
+            buf_[i] = valueOf(b, keys[i]);
         }
+        decoded_ = true;
     }
-};
 
-template<class T>
-struct TWithCount {
-    T               t;
-    std::size_t     count = 0;
-    friend std::ostream &operator<<(std::ostream &os, TWithCount const &tg) {
-        os << "[" << tg.t << ":" << tg.count << "]";
-        return os;
+    void nextBlock() {
+        ++block_;
+        row_ = 0;
+        decoded_ = false;
     }
-};
 
-template<class T>
-bool
-tWithCountJoiner(TWithCount<T> &tw, T const &t)
-{
-    if ( tw.count == 0 || tw.t == t ) {
-        if ( tw.count == 0 ) {
-            tw.t = t;
+    /* part(values, n) for the rest of a block read into, whole(block) for
+     * the blocks after; consumes them all
+     */
+    template<class Part, class Whole>
+    void consume(Part part, Whole whole) {
+        if ( left_ == 0 ) return;
+        auto const &blocks = store_->blocks;
+        auto j = block_;
+        if ( row_ > 0 || decoded_ ) {
+            decode();
+            part(buf_.data() + row_, buf_.size() - row_);
+            ++j;
+        }
+        for ( ; j < blocks.size(); ++j ) {
+            whole(blocks[j]);
+        }
+        left_ = 0;
+        block_ = blocks.size();
+        row_ = 0;
+        decoded_ = false;
+    }
+
+    value_type extremum(bool max) {
+        if constexpr ( std::is_integral_v<T> ) {
+            T res = max ? std::numeric_limits<T>::min() : std::numeric_limits<T>::max();
+            auto keep = [&res, max] (T t) {
+                if ( max ? res < t : t < res ) res = t;
+            };
+            consume([&keep] (T const *v, std::size_t n) {
+                for ( std::size_t i = 0; i < n; ++i ) keep(v[i]);
+            }, [&keep, max] (Block const &b) {
+                keep(kernel_from_ordered_bits<T>(max ? b.top : b.base));
+            });
+            return res;
+        } else {
+            return max ? LazyIteratorBase<self_type>::numeric_max() : LazyIteratorBase<self_type>::numeric_min();
         }
-        ++tw.count;
-        return true;
-    } else {
-        return false;
     }
-}
+
+    std::shared_ptr<Store const>    store_;
+    std::size_t                     left_ = 0;
+    std::size_t                     block_ = 0;
+    std::size_t                     row_ = 0;
+
+    /* block_, decoded */
+    std::vector<T>                  buf_;
+    bool                            decoded_ = false;
+};
 
 template<class Derived>
 class LazyIteratorBase {
 public:
+    /* whether Derived offers data(), a pointer to its remaining() elements */
+    static constexpr bool contiguous = false;
+
+    /* whether Derived offers nextBatch(), see ColumnBatch */
+    static constexpr bool batchable = false;
+
+    /*
+     * Func: value_type -> lazy iterator, or value_type -> container
+     */
+    template<class Func>
+    auto flatMap(Func f) {
+        return LazyIteratorWithFlatMap<Derived, Func>(
+                *static_cast<Derived*>(this), f
+                );
+    }
+
+    /* this, then each of others */
+    template<class... Others>
+    auto concat(Others... others) {
+        return LazyIteratorWithConcat<Derived, Others...>(
+                *static_cast<Derived*>(this), others...
+                );
+    }
+
     template<class Pred>
     auto filter(Pred pred)
     {
@@ -532,6 +3136,17 @@ public:
                 );
     }
 
+    /* like filter(p1).filter(p2)..., in an order adapted to the data;
+     * the predicates must not have side effects
+     */
+    template<class... Preds>
+    auto filterAll(Preds... preds) {
+        static_assert(sizeof...(Preds) > 0, "filterAll needs a predicate");
+        return LazyIteratorWithAdaptiveFilter<Derived, Preds...>(
+                *static_cast<Derived*>(this), preds...
+                );
+    }
+
     template<class Func>
     auto map(Func f)
     {
@@ -547,6 +3162,28 @@ public:
                 );
     }
 
+    /*
+     * Stamp: value_type -> Time
+     * Accumulator: void (&AfterType, value_type const &)
+     */
+    template<class AfterType, class Stamp, class Accumulator, class Time>
+    auto tumblingWindow(Stamp stamp, Time width, Accumulator acc) {
+        using time_type = std::decay_t<std::result_of_t<Stamp(typename Derived::value_type)>>;
+        using Boundary = TumblingBoundary<time_type>;
+        return LazyIteratorWithTimeWindow<Derived, Stamp, Accumulator, AfterType, Boundary>(
+                *static_cast<Derived*>(this), stamp, acc, Boundary{static_cast<time_type>(width)}
+                );
+    }
+
+    template<class AfterType, class Stamp, class Accumulator, class Time>
+    auto sessionWindow(Stamp stamp, Time gap, Accumulator acc) {
+        using time_type = std::decay_t<std::result_of_t<Stamp(typename Derived::value_type)>>;
+        using Boundary = SessionBoundary<time_type>;
+        return LazyIteratorWithTimeWindow<Derived, Stamp, Accumulator, AfterType, Boundary>(
+                *static_cast<Derived*>(this), stamp, acc, Boundary{static_cast<time_type>(gap)}
+                );
+    }
+
     auto groupSame() {
         return groupBy<TWithCount<typename Derived::value_type>>(
                 tWithCountJoiner<typename Derived::value_type>
@@ -561,12 +3198,81 @@ public:
                 );
     }
 
+    /* window(n).aggregate(op) / .sum() / .numeric_min() / .numeric_max() / .mean() */
+    auto window(std::size_t n) {
+        return SlidingWindow<Derived>(*static_cast<Derived*>(this), n);
+    }
+
+    /* Span of up to n elements at a time, see LazyIteratorWithBatch */
+    auto batch(std::size_t n) {
+        return LazyIteratorWithBatch<Derived>(
+                *static_cast<Derived*>(this), n
+                );
+    }
+
     auto take(std::size_t howmany) {
         return LazyIteratorWithTake<Derived>(
                 *static_cast<Derived*>(this), howmany
                 );
     }
 
+    /* uniform sample of k elements, in one pass with Algorithm L:
+     * after the reservoir fills, the distance to the next replaced
+     * element is drawn directly and the elements in between are
+     * jumped over with advance()
+     */
+    auto sample(std::size_t k, std::uint64_t seed = std::mt19937_64::default_seed) {
+        std::vector<typename Derived::value_type> reservoir;
+        reservoir.reserve(k);
+        while ( reservoir.size() < k && static_cast<Derived*>(this)->ok() ) {
+            reservoir.push_back(static_cast<Derived*>(this)->operator*());
+            static_cast<Derived*>(this)->operator++();
+        }
+
+        if ( k != 0 ) {
+            std::mt19937_64 rng(seed);
+            std::uniform_real_distribution<double> unit(0.0, 1.0);
+            std::uniform_int_distribution<std::size_t> slot(0, k - 1);
+            auto u = [&] () { return std::max(unit(rng), std::numeric_limits<double>::min()); };
+
+            double w = std::exp(std::log(u()) / k);
+            while ( static_cast<Derived*>(this)->ok() ) {
+                double skip = std::floor(std::log(u()) / std::log1p(-w));
+                if ( skip >= static_cast<double>(std::numeric_limits<std::size_t>::max()) ) {
+                    break;
+                }
+                static_cast<Derived*>(this)->advance(static_cast<std::size_t>(skip));
+                if ( !static_cast<Derived*>(this)->ok() ) break;
+
+                reservoir[slot(rng)] = static_cast<Derived*>(this)->operator*();
+                static_cast<Derived*>(this)->operator++();
+                w *= std::exp(std::log(u()) / k);
+            }
+        }
+
+        return LazyIteratorWithVectorContent<typename Derived::value_type>(std::move(reservoir));
+    }
+
+    /* keeps each element independently with probability p */
+    auto sampleFraction(double p, std::uint64_t seed = std::mt19937_64::default_seed) {
+        return LazyIteratorWithBernoulli<Derived>(
+                *static_cast<Derived*>(this), p, seed
+                );
+    }
+
+    /*
+     * skip at most howmany elements, return how many were skipped;
+     * stages that can do better than repeated operator++ hide this
+     */
+    std::size_t advance(std::size_t howmany) {
+        std::size_t step = 0;
+        while ( step < howmany && static_cast<Derived*>(this)->ok() ) {
+            static_cast<Derived*>(this)->operator++();
+            ++step;
+        }
+        return step;
+    }
+
     template<class StoreIterator>
     void store(StoreIterator store_iter) {
         while ( static_cast<Derived*>(this)->ok() ) {
@@ -586,6 +3292,13 @@ public:
                 "Binary must be InitValueType -> value_type -> InitValueType");
 
         auto res = init_value;
+        if constexpr ( Derived::batchable ) {
+            ColumnBatch<typename Derived::value_type> batch;
+            while ( static_cast<Derived*>(this)->nextBatch(batch, batch.capacity) ) {
+                batch.foreach([&] (auto const &e) { res = binary(res, e); });
+            }
+            return res;
+        }
         while ( static_cast<Derived*>(this)->ok() ) {
             res = binary(res, static_cast<Derived*>(this)->operator*());
             static_cast<Derived*>(this)->operator++();
@@ -593,6 +3306,26 @@ public:
         return res;
     }
 
+    /*
+     * Binary: (InitValueType, value_type) -> InitValueType
+     *
+     * running reduce; for large materialized inputs see
+     * LazyIteratorWithVectorContent::parallelScan()
+     */
+    template<class Binary, class InitValueType>
+    auto scan(Binary binary, InitValueType init_value) {
+        return LazyIteratorWithScan<Derived, Binary, InitValueType, true>(
+                *static_cast<Derived*>(this), binary, init_value
+                );
+    }
+
+    template<class Binary, class InitValueType>
+    auto exclusiveScan(Binary binary, InitValueType init_value) {
+        return LazyIteratorWithScan<Derived, Binary, InitValueType, false>(
+                *static_cast<Derived*>(this), binary, init_value
+                );
+    }
+
     /*
      * Pred: value_type -> bool
      */
@@ -606,6 +3339,13 @@ public:
 
     std::size_t count() {
         std::size_t cnt = 0;
+        if constexpr ( Derived::batchable ) {
+            ColumnBatch<typename Derived::value_type> batch;
+            while ( static_cast<Derived*>(this)->nextBatch(batch, batch.capacity) ) {
+                cnt += batch.size();
+            }
+            return cnt;
+        }
         while ( static_cast<Derived*>(this)->ok() ) {
             ++cnt;
             static_cast<Derived*>(this)->operator++();
@@ -628,6 +3368,311 @@ public:
                 std::numeric_limits<typename Derived::value_type>::min());
     }
 
+    /*
+     * Formatter: void (BufferedWriter &, value_type const &)
+     *
+     * writes one record per element, each followed by '\n'; the default
+     * formatter is lazyFormat(). With background = true the writes run
+     * on their own thread. Returns the number of records, fd is left open.
+     * Needs LazyWriter.hh
+     */
+    template<class Formatter = LazyFormat>
+    std::size_t writeTo(int fd, Formatter f = Formatter(), bool background = false) {
+        lazy_dependent_t<BufferedWriter, Formatter> w(fd, 1 << 20, background);
+        auto n = writeTo(w, f);
+        w.close();
+        return n;
+    }
+
+    /* creates or truncates path */
+    template<class Formatter = LazyFormat>
+    std::size_t writeTo(std::string const &path, Formatter f = Formatter(), bool background = false) {
+        lazy_dependent_t<BufferedWriter, Formatter> w(path, 1 << 20, background);
+        auto n = writeTo(w, f);
+        w.close();
+        return n;
+    }
+
+    /* into a writer that outlives this call, e.g. shared by several iterators */
+    template<class Formatter = LazyFormat>
+    std::size_t writeTo(lazy_dependent_t<BufferedWriter, Formatter> &w, Formatter f = Formatter()) {
+        std::size_t n = 0;
+        auto record = [&] (auto const &e) { f(w, e); w.put('\n'); ++n; };
+        if constexpr ( Derived::batchable ) {
+            ColumnBatch<typename Derived::value_type> batch;
+            while ( static_cast<Derived*>(this)->nextBatch(batch, batch.capacity) ) {
+                batch.foreach(record);
+            }
+            return n;
+        }
+        while ( static_cast<Derived*>(this)->ok() ) {
+            record(static_cast<Derived*>(this)->operator*());
+            static_cast<Derived*>(this)->operator++();
+        }
+        return n;
+    }
+
+    /* a column file, read back with makeLazyIteratorFromColumnFile<value_type>();
+     * needs LazyColumns.hh. Returns the number of rows
+     */
+    std::size_t writeColumns(std::string const &path, std::size_t block_rows = 1 << 16) {
+        ColumnFileWriter<typename Derived::value_type> w(path, block_rows);
+        std::size_t n = 0;
+        while ( static_cast<Derived*>(this)->ok() ) {
+            w.append(static_cast<Derived*>(this)->operator*());
+            static_cast<Derived*>(this)->operator++();
+            ++n;
+        }
+        w.close();
+        return n;
+    }
+
+    /* one pass, fixed memory; query the returned KllSketch with
+     * quantile(q), or merge() it with sketches of other partitions
+     */
+    auto approxQuantiles(std::size_t k = 200) {
+        KllSketch<typename Derived::value_type> sketch(k);
+        while ( static_cast<Derived*>(this)->ok() ) {
+            sketch.update(static_cast<Derived*>(this)->operator*());
+            static_cast<Derived*>(this)->operator++();
+        }
+        return sketch;
+    }
+
+    /* one pass, k counters; top() of the returned SpaceSaving lists
+     * the most frequent values
+     */
+    auto heavyHitters(std::size_t k) {
+        SpaceSaving<typename Derived::value_type> sketch(k);
+        while ( static_cast<Derived*>(this)->ok() ) {
+            sketch.update(static_cast<Derived*>(this)->operator*());
+            static_cast<Derived*>(this)->operator++();
+        }
+        return sketch;
+    }
+
+    /*
+     * Specs: sumOf(f), minOf(f), maxOf(f), countOf(), meanVar(f), see Aggregators.hh
+     *
+     * std::tuple of their results, computed in one pass:
+     *  auto [sum, min] = iter.aggregate(sumOf(), minOf());
+     */
+    template<class... Specs>
+    auto aggregate(Specs... specs) {
+        return partialAggregate(specs...).result();
+    }
+
+    /* the Aggregation itself, to merge() with that of another part of
+     * the same stream before asking for its result()
+     */
+    template<class... Specs>
+    auto partialAggregate(Specs... specs) {
+        using T = typename Derived::value_type;
+        Aggregation<aggregate_bind_t<Specs, T>...> aggs(specs.template bind<T>()...);
+        if constexpr ( Derived::batchable ) {
+            ColumnBatch<T> batch;
+            while ( static_cast<Derived*>(this)->nextBatch(batch, batch.capacity) ) {
+                batch.foreach([&] (auto const &e) { aggs.update(e); });
+            }
+            return aggs;
+        }
+        while ( static_cast<Derived*>(this)->ok() ) {
+            aggs.update(static_cast<Derived*>(this)->operator*());
+            static_cast<Derived*>(this)->operator++();
+        }
+        return aggs;
+    }
+
+    /* aggregate() over all cores: a sized pipeline is split into equal
+     * parts, aggregated in parallel and merged in order. Contiguous
+     * content is split into views of data(), a pipeline of viewable
+     * stages into view()s over the same content, and sources with
+     * split() by it; anything else into copies with dup(), advance() and
+     * take(). The functions along the pipeline must be safe to call from
+     * several threads.
+     */
+    template<class... Specs>
+    auto parallelAggregate(Specs... specs) {
+        static_assert(has_remaining_v<Derived>, "parallelAggregate needs a sized pipeline");
+        using T = typename Derived::value_type;
+        auto &self = *static_cast<Derived*>(this);
+        auto n = self.remaining();
+        auto nparts = kernel_threads(n, 0);
+
+        using Aggs = Aggregation<aggregate_bind_t<Specs, T>...>;
+        std::vector<std::optional<Aggs>> parts(nparts);
+        if constexpr ( Derived::contiguous ) {
+            T const *p = self.data();
+            kernel_parallel_blocks(n, nparts, [&] (std::size_t i, std::size_t beg, std::size_t end) {
+                parts[i].emplace(LazyIteratorRaw<T const *>(p + beg, p + end).partialAggregate(specs...));
+            });
+        } else if constexpr ( has_view_v<Derived> ) {
+            kernel_parallel_blocks(n, nparts, [&] (std::size_t i, std::size_t beg, std::size_t end) {
+                parts[i].emplace(self.view(beg, end).partialAggregate(specs...));
+            });
+        } else if constexpr ( has_split_v<Derived> ) {
+            auto splits = self.split(nparts);
+            kernel_parallel_blocks(nparts, nparts, [&] (std::size_t i, std::size_t, std::size_t) {
+                parts[i].emplace(splits[i].partialAggregate(specs...));
+            });
+        } else {
+            kernel_parallel_blocks(n, nparts, [&] (std::size_t i, std::size_t beg, std::size_t end) {
+                auto part = self.dup();
+                part.advance(beg);
+                parts[i].emplace(part.take(end - beg).partialAggregate(specs...));
+            });
+        }
+        self.advance(n);
+
+        for ( std::size_t i = 1; i < nparts; ++i ) {
+            parts[0]->merge(*parts[i]);
+        }
+        return parts[0]->result();
+    }
+
+    /* one pass, numerically stable: blocks of a batchable pipeline are
+     * summed with SIMD around the running mean, blocks are merged with
+     * Chan's formula, anything else is updated one element at a time
+     * with Welford's. The result merge()s with that of other parts.
+     */
+    MeanVariance meanVariance() {
+        using T = typename Derived::value_type;
+        MeanVariance mv;
+        if constexpr ( Derived::batchable ) {
+            ColumnBatch<T> batch;
+            auto selected = std::make_unique<T[]>(batch.capacity);
+            while ( static_cast<Derived*>(this)->nextBatch(batch, batch.capacity) ) {
+                if ( batch.dense ) {
+                    mv.updateBlock(batch.values, batch.rows);
+                } else {
+                    for ( std::size_t j = 0; j < batch.selected; ++j ) {
+                        selected[j] = batch.values[batch.sel[j]];
+                    }
+                    mv.updateBlock(selected.get(), batch.selected);
+                }
+            }
+            return mv;
+        }
+        while ( static_cast<Derived*>(this)->ok() ) {
+            mv.update(static_cast<double>(static_cast<Derived*>(this)->operator*()));
+            static_cast<Derived*>(this)->operator++();
+        }
+        return mv;
+    }
+
+    double stddev() {
+        return meanVariance().stddev();
+    }
+
+    /* pairs up the elements with those of other, up to the shorter one;
+     * SIMD when both are contiguous
+     */
+    template<class Other>
+    CoMoments covariance(Other other) {
+        static_assert(is_lazy_iterator_v<Other>, "covariance needs a LazyIterator");
+        auto &self = *static_cast<Derived*>(this);
+        CoMoments cm;
+        if constexpr ( Derived::contiguous && Other::contiguous ) {
+            auto n = std::min(self.remaining(), other.remaining());
+            while ( n > 0 ) {
+                auto m = std::min(n, lazy_expr_batch);
+                cm.updateBlock(self.data(), other.data(), m);
+                self.advance(m);
+                other.advance(m);
+                n -= m;
+            }
+            return cm;
+        }
+        while ( self.ok() && other.ok() ) {
+            cm.update(static_cast<double>(*self), static_cast<double>(*other));
+            ++self;
+            ++other;
+        }
+        return cm;
+    }
+
+    template<class Other>
+    double correlation(Other other) {
+        return covariance(other).correlation();
+    }
+
+    /* sum of the products of the elements with those of other, up to the
+     * shorter one; one SIMD loop when both are contiguous
+     */
+    template<class Other>
+    auto dot(Other other) {
+        return zipSum(other,
+                [] (auto const *x, auto const *y, std::size_t n) { return kernel_dot(x, y, n); },
+                [] (auto x, auto y) { return x * y; });
+    }
+
+    /* the elements weighted by those of weights, through the dot kernel */
+    template<class Weights>
+    auto weightedSum(Weights weights) {
+        return dot(weights);
+    }
+
+    template<class Other>
+    double l2Distance(Other other) {
+        return std::sqrt(static_cast<double>(zipSum(other,
+                [] (auto const *x, auto const *y, std::size_t n) { return kernel_squared_distance(x, y, n); },
+                [] (auto x, auto y) { return (x - y) * (x - y); })));
+    }
+
+    /*
+     * F: (value_type, Other::value_type) -> R
+     * Binary: (InitValueType, R) -> InitValueType
+     *
+     * reduce of f over the pairs of elements. When both sides are
+     * contiguous and f is a placeholder expression, f is evaluated a
+     * block at a time with evalBatch(); a binary _1 + _2 or std::plus<>
+     * then sums the block in SIMD lanes.
+     */
+    template<class Other, class F, class Binary, class InitValueType>
+    auto zipReduce(Other other, F f, Binary binary, InitValueType init_value) {
+        static_assert(is_lazy_iterator_v<Other>, "zipReduce needs a LazyIterator");
+        using T = typename Derived::value_type;
+        using U = typename Other::value_type;
+        auto &self = *static_cast<Derived*>(this);
+        auto res = init_value;
+        if constexpr ( Derived::contiguous && Other::contiguous && is_lazy_expr_v<F> ) {
+            using R = lazy_expr_result_t<typename F::node_type, T, U>;
+            constexpr bool plus = kernel_is_plus_v<Binary, InitValueType>
+                || std::is_same_v<Binary, decltype(lazy_placeholders::_1 + lazy_placeholders::_2)>;
+            R buf[lazy_expr_batch];
+            auto n = std::min(self.remaining(), other.remaining());
+            while ( n > 0 ) {
+                auto m = std::min(n, lazy_expr_batch);
+                f.evalBatch(buf, m, self.data(), other.data());
+                if constexpr ( plus && std::is_arithmetic_v<R> ) {
+                    res = binary(res, kernel_sum(buf, m));
+                } else {
+                    for ( std::size_t i = 0; i < m; ++i ) {
+                        res = binary(res, buf[i]);
+                    }
+                }
+                self.advance(m);
+                other.advance(m);
+                n -= m;
+            }
+            return res;
+        }
+        while ( self.ok() && other.ok() ) {
+            res = binary(res, f(*self, *other));
+            ++self;
+            ++other;
+        }
+        return res;
+    }
+
+    /*
+     * Kernel: Span<const value_type> -> void
+     */
+    template<class Kernel>
+    void foreachBatch(Kernel kernel, std::size_t n = 1024) {
+        batch(n).foreach(kernel);
+    }
+
     template<class Pred>
     void foreach(Pred pred) {
         while ( static_cast<Derived*>(this)->ok() ) {
@@ -638,10 +3683,22 @@ public:
 
     /* for LazyIteratorWithVectorContent:
      *
-     * self_type &sort();
+     * self_type &sort() &;
+     *
+     * template<class Compare>
+     * self_type &sort(Compare compare) &;
+     *
+     * on a temporary, e.g. done().sort(), the sort is deferred:
      *
      * template<class Compare>
-     * self_type &sort(Compare compare);
+     * LazyIteratorWithSortedContent<T, Compare>
+     * sort(Compare compare) &&;
+     *
+     * template<class Binary>
+     * self_type &parallelScan(Binary binary, T init, std::size_t nthreads = 0);
+     *
+     * template<class Binary>
+     * self_type &parallelExclusiveScan(Binary binary, T init, std::size_t nthreads = 0);
      *
      * LazyIteratorRaw<ReverseVectorIterator>
      * reverse();
@@ -649,13 +3706,51 @@ public:
 
     auto done() {
         std::vector<typename Derived::value_type> vec;
+        if constexpr ( has_remaining_v<Derived> ) {
+            vec.reserve(static_cast<Derived*>(this)->remaining());
+        }
         store(std::back_inserter(vec));
         return LazyIteratorWithVectorContent<typename Derived::value_type>(std::move(vec));
     }
 
+    /* done() in blocks of block_rows encoded small, integers or strings;
+     * see LazyIteratorWithCompressedContent
+     */
+    auto doneCompressed(std::size_t block_rows = 4096) {
+        return LazyIteratorWithCompressedContent<typename Derived::value_type>(
+                *static_cast<Derived*>(this), block_rows
+                );
+    }
+
     auto dup() {
         return *static_cast<Derived*>(this);
     }
+private:
+    /* kernel over blocks when both sides are contiguous, op pair by pair otherwise */
+    template<class Other, class Kernel, class Op>
+    auto zipSum(Other &other, Kernel kernel, Op op) {
+        static_assert(is_lazy_iterator_v<Other>, "needs a LazyIterator");
+        using Acc = kernel_acc_t<typename Derived::value_type, typename Other::value_type>;
+        auto &self = *static_cast<Derived*>(this);
+        Acc acc = 0;
+        if constexpr ( Derived::contiguous && Other::contiguous ) {
+            auto n = std::min(self.remaining(), other.remaining());
+            while ( n > 0 ) {
+                auto m = std::min<std::size_t>(n, 1 << 16);
+                acc += kernel(self.data(), other.data(), m);
+                self.advance(m);
+                other.advance(m);
+                n -= m;
+            }
+            return acc;
+        }
+        while ( self.ok() && other.ok() ) {
+            acc += op(static_cast<Acc>(*self), static_cast<Acc>(*other));
+            ++self;
+            ++other;
+        }
+        return acc;
+    }
 };
 
 template<class Iterator>
@@ -672,6 +3767,36 @@ makeLazyIteratorFromGenerator(Generator gen, ssize_t max_count = -1)
     return LazyIteratorWithGenerator<Generator>(gen, max_count);
 }
 
+/* f(0), f(1), ... f(n - 1) */
+template<class Func>
+auto
+makeLazyIteratorFromIndex(Func f, std::size_t n)
+{
+    return LazyIteratorWithIndex<Func>(f, 0, n);
+}
+
+/* n reproducible uniform doubles in [0, 1), any part computed alone */
+inline auto
+makeLazyIteratorFromUniform(std::size_t n, std::uint64_t seed = 0, std::uint64_t stream = 0)
+{
+    return makeLazyIteratorFromIndex(PhiloxUniform{Philox4x32(seed), stream}, n);
+}
+
+/* like Python's range(begin, end, step) */
+template<class T>
+auto
+makeLazyIteratorFromIota(T begin, T end, std::make_signed_t<T> step = 1)
+{
+    return LazyIteratorWithIota<T>(begin, end, step);
+}
+
+template<class... Iterators>
+auto
+makeLazyIteratorFromConcat(Iterators... iters)
+{
+    return LazyIteratorWithConcat<Iterators...>(iters...);
+}
+
 template<class Iterator1, class Iterator2, class Zipper>
 auto
 makeLazyIteratorFromZipWith(Iterator1 iter1, Iterator2 iter2, Zipper zipper)
@@ -690,4 +3815,59 @@ makeLazyIteratorFromZip(Iterator1 iter1, Iterator2 iter2)
             );
 }
 
+template<class... Iterators>
+auto
+makeLazyIteratorFromZipN(Iterators... iters)
+{
+    return LazyIteratorWithZipN<Iterators...>(iters...);
+}
+
+inline auto
+makeLazyIteratorFromSplit(std::string_view text, char delim)
+{
+    return LazyIteratorWithSplit<SplitByte>(text, SplitByte{delim});
+}
+
+inline auto
+makeLazyIteratorFromSplit(std::string_view text, SplitAnyOf delim)
+{
+    return LazyIteratorWithSplit<SplitAnyOf>(text, std::move(delim));
+}
+
+/* a multi-byte delimiter */
+inline auto
+makeLazyIteratorFromSplit(std::string_view text, std::string_view delim)
+{
+    return LazyIteratorWithSplit<SplitString>(text, SplitString{std::string(delim)});
+}
+
+/*
+ * Work: (Source) -> R, called from several threads at once
+ *
+ * the results of work on each part of source.split(nthreads), in order,
+ * e.g. partialAggregate()s to merge(). Every split(n) hands the elements
+ * left to its n parts and leaves the source empty
+ */
+template<class Source, class Work>
+auto
+parallelSplits(Source source, Work work, std::size_t nthreads = 0)
+{
+    if ( nthreads == 0 ) {
+        nthreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    auto parts = source.split(nthreads);
+    using R = decltype(work(parts.front()));
+    std::vector<std::optional<R>> results(parts.size());
+    kernel_parallel_blocks(parts.size(), parts.size(), [&] (std::size_t i, std::size_t, std::size_t) {
+        results[i].emplace(work(parts[i]));
+    });
+
+    std::vector<R> res;
+    res.reserve(results.size());
+    for ( auto &r : results ) {
+        res.push_back(std::move(*r));
+    }
+    return res;
+}
+
 #endif /* _LAZYITERATOR_HH_ */
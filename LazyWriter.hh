@@ -0,0 +1,354 @@
+#ifndef _LAZYWRITER_HH_
+#define _LAZYWRITER_HH_
+
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <charconv>
+#include <sstream>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <system_error>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+/*
+ * BufferedWriter: records formatted with std::to_chars straight into a
+ * large buffer, written out in big write()s. A chunk bigger than what is
+ * left of the buffer goes out with the buffer in a single writev().
+ *
+ * With background = true a second buffer is filled while a thread writes
+ * the first.
+ *
+ * Failures throw std::system_error, from the next flush() or close()
+ * when the background thread met them.
+ */
+class BufferedWriter
+{
+public:
+    explicit BufferedWriter(int fd, std::size_t buffer_size = 1 << 20, bool background = false)
+        : fd_(fd)
+        , size_(std::max<std::size_t>(buffer_size, 4096))
+        , buf_(new char[size_])
+    {
+        if ( background ) {
+            spare_.reset(new char[size_]);
+            thread_ = std::thread([this] () { work(); });
+        }
+    }
+
+    /* creates or truncates path, closed by close() */
+    explicit BufferedWriter(std::string const &path, std::size_t buffer_size = 1 << 20,
+                            bool background = false)
+        : BufferedWriter(open(path), buffer_size, background)
+    {
+        own_fd_ = true;
+    }
+
+    BufferedWriter(BufferedWriter const &) = delete;
+    BufferedWriter &operator=(BufferedWriter const &) = delete;
+
+    /* errors are lost here, close() to see them */
+    ~BufferedWriter() {
+        try {
+            close();
+        } catch ( std::system_error const & ) {
+        }
+    }
+
+    void append(char const *p, std::size_t n) {
+        if ( n <= size_ - used_ ) {
+            std::memcpy(buf_.get() + used_, p, n);
+            used_ += n;
+        } else if ( n < size_ / 2 ) {
+            flush();
+            std::memcpy(buf_.get(), p, n);
+            used_ = n;
+        } else {
+            writeAround(p, n);
+        }
+    }
+
+    void append(std::string_view s) {
+        append(s.data(), s.size());
+    }
+
+    void put(char c) {
+        if ( used_ == size_ ) flush();
+        buf_[used_++] = c;
+    }
+
+    /* integers and floating points, shortest round trip */
+    template<class T>
+    void number(T t) {
+        if ( size_ - used_ < 64 ) flush();
+        auto res = std::to_chars(buf_.get() + used_, buf_.get() + size_, t);
+        used_ = res.ptr - buf_.get();
+    }
+
+    /* hands the buffer to write(), or to the background thread */
+    void flush() {
+        if ( thread_.joinable() ) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            idle_.wait(lock, [this] () { return pending_ == 0; });
+            check();
+            if ( used_ == 0 ) return;
+            std::swap(buf_, spare_);
+            pending_ = used_;
+            used_ = 0;
+            lock.unlock();
+            wake_.notify_one();
+        } else {
+            writeAll(buf_.get(), used_);
+            used_ = 0;
+        }
+    }
+
+    /* flushes, waits for the background thread, closes an fd it opened */
+    void close() {
+        if ( closed_ ) return;
+        closed_ = true;
+        std::exception_ptr failed;
+        try {
+            flush();
+        } catch ( std::system_error const & ) {
+            failed = std::current_exception();
+        }
+        if ( thread_.joinable() ) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            wake_.notify_one();
+            thread_.join();
+        }
+        if ( own_fd_ && ::close(fd_) < 0 && !failed ) {
+            throw std::system_error(errno, std::generic_category(), "close");
+        }
+        if ( failed ) {
+            std::rethrow_exception(failed);
+        }
+        check();
+    }
+private:
+    static int open(std::string const &path) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if ( fd < 0 ) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        return fd;
+    }
+
+    /* the buffer then p, with one writev() as long as both fit in it */
+    void writeAround(char const *p, std::size_t n) {
+        if ( thread_.joinable() ) {
+            flush();
+            std::unique_lock<std::mutex> lock(mutex_);
+            idle_.wait(lock, [this] () { return pending_ == 0; });
+            check();
+            lock.unlock();
+            writeAll(p, n);
+            return;
+        }
+        struct iovec iov[2] = {{buf_.get(), used_}, {const_cast<char *>(p), n}};
+        int first = used_ ? 0 : 1;
+        while ( iov[1].iov_len ) {
+            ssize_t wrote = ::writev(fd_, iov + first, 2 - first);
+            if ( wrote < 0 && errno == EINTR ) continue;
+            if ( wrote < 0 ) {
+                throw std::system_error(errno, std::generic_category(), "writev");
+            }
+            for ( int i = first; i < 2 && wrote > 0; ++i ) {
+                auto step = std::min<std::size_t>(wrote, iov[i].iov_len);
+                iov[i].iov_base = static_cast<char *>(iov[i].iov_base) + step;
+                iov[i].iov_len -= step;
+                wrote -= step;
+            }
+            first = iov[0].iov_len ? 0 : 1;
+        }
+        used_ = 0;
+    }
+
+    void writeAll(char const *p, std::size_t n) {
+        while ( n ) {
+            ssize_t wrote = ::write(fd_, p, n);
+            if ( wrote < 0 && errno == EINTR ) continue;
+            if ( wrote < 0 ) {
+                throw std::system_error(errno, std::generic_category(), "write");
+            }
+            p += wrote;
+            n -= wrote;
+        }
+    }
+
+    /* under mutex_ */
+    void check() {
+        if ( error_ ) {
+            int err = error_;
+            error_ = 0;
+            throw std::system_error(err, std::generic_category(), "write");
+        }
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for ( ;; ) {
+            wake_.wait(lock, [this] () { return stop_ || pending_; });
+            if ( pending_ == 0 ) return;
+            auto n = pending_;
+            lock.unlock();
+            int err = 0;
+            try {
+                writeAll(spare_.get(), n);
+            } catch ( std::system_error const &e ) {
+                err = e.code().value();
+            }
+            lock.lock();
+            error_ = err;
+            pending_ = 0;
+            idle_.notify_one();
+        }
+    }
+
+    int                         fd_;
+    bool                        own_fd_ = false;
+    bool                        closed_ = false;
+    std::size_t                 size_;
+    std::unique_ptr<char[]>     buf_;
+    std::size_t                 used_ = 0;
+
+    /* the buffer being written by the background thread */
+    std::unique_ptr<char[]>     spare_;
+    std::thread                 thread_;
+    std::mutex                  mutex_;
+    std::condition_variable     wake_;
+    std::condition_variable     idle_;
+    std::size_t                 pending_ = 0;
+    int                         error_ = 0;
+    bool                        stop_ = false;
+};
+
+/*
+ * lazyFormat(w, t) writes t as text: numbers with std::to_chars, strings
+ * as they are, pairs and tuples as tab separated fields, anything else
+ * with operator<<. Overloads for other types are found by ADL.
+ */
+template<class T>
+void lazyFormat(BufferedWriter &w, T const &t);
+
+template<class A, class B>
+void lazyFormat(BufferedWriter &w, std::pair<A, B> const &p);
+
+template<class... Ts>
+void lazyFormat(BufferedWriter &w, std::tuple<Ts...> const &t);
+
+template<class T>
+void
+lazyFormat(BufferedWriter &w, T const &t)
+{
+    if constexpr ( std::is_same_v<T, bool> ) {
+        w.put(t ? '1' : '0');
+    } else if constexpr ( std::is_same_v<T, char> ) {
+        w.put(t);
+    } else if constexpr ( std::is_arithmetic_v<T> ) {
+        w.number(t);
+    } else if constexpr ( std::is_convertible_v<T const &, std::string_view> ) {
+        w.append(std::string_view(t));
+    } else {
+        std::ostringstream os;
+        os << t;
+        w.append(os.str());
+    }
+}
+
+template<class A, class B>
+void
+lazyFormat(BufferedWriter &w, std::pair<A, B> const &p)
+{
+    lazyFormat(w, p.first);
+    w.put('\t');
+    lazyFormat(w, p.second);
+}
+
+template<class... Ts>
+void
+lazyFormat(BufferedWriter &w, std::tuple<Ts...> const &t)
+{
+    std::apply([&w] (auto const &... e) {
+        std::size_t i = 0;
+        ((i++ ? w.put('\t') : void(), lazyFormat(w, e)), ...);
+    }, t);
+}
+
+/* the default formatter of writeTo() */
+struct LazyFormat {
+    template<class T>
+    void operator()(BufferedWriter &w, T const &t) const {
+        lazyFormat(w, t);
+    }
+};
+
+/* the 64 bytes before the elements of a snapshot file */
+struct SnapshotHeader {
+    char            magic[8] = {'L', 'Z', 'S', 'N', 'A', 'P', '1', 0};
+    std::uint64_t   element_size = 0;
+    std::uint64_t   element_align = 0;
+    std::uint64_t   count = 0;
+    char            pad[32] = {};
+};
+
+static_assert(sizeof(SnapshotHeader) == 64, "elements start 64 bytes in");
+
+/*
+ * The raw bytes of [beg, end) after a SnapshotHeader, written to
+ * path.tmp and renamed to path, so that a process mapping path never
+ * sees half of it. Returns the number of elements.
+ */
+template<class Iterator>
+std::size_t
+lazy_write_snapshot(std::string const &path, Iterator beg, Iterator end)
+{
+    using T = typename std::iterator_traits<Iterator>::value_type;
+    static_assert(std::is_trivially_copyable_v<T>, "snapshots of trivially copyable types");
+    static_assert(alignof(T) <= sizeof(SnapshotHeader), "elements aligned on at most 64 bytes");
+
+    std::string tmp = path + ".tmp";
+    SnapshotHeader header;
+    header.element_size = sizeof(T);
+    header.element_align = alignof(T);
+    header.count = std::distance(beg, end);
+    try {
+        BufferedWriter w(tmp);
+        w.append(reinterpret_cast<char const *>(&header), sizeof(header));
+        if constexpr ( std::is_pointer_v<Iterator> ) {
+            w.append(reinterpret_cast<char const *>(beg), header.count * sizeof(T));
+        } else {
+            for ( ; beg != end; ++beg ) {
+                T const &t = *beg;
+                w.append(reinterpret_cast<char const *>(std::addressof(t)), sizeof(T));
+            }
+        }
+        w.close();
+        if ( std::rename(tmp.c_str(), path.c_str()) < 0 ) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+    } catch ( ... ) {
+        std::remove(tmp.c_str());
+        throw;
+    }
+    return header.count;
+}
+
+#endif /* _LAZYWRITER_HH_ */
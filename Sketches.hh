@@ -0,0 +1,317 @@
+#ifndef _SKETCHES_HH_
+#define _SKETCHES_HH_
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
+#include <cmath>
+#include <iostream>
+
+/*
+ * Fixed memory summaries of a stream, filled one element at a time by
+ * update(), and combined by merge() when several threads each summarized
+ * a part of the same stream.
+ */
+
+/*
+ * KLL quantile sketch (Karnin, Lang, Liberty).
+ *
+ * Level h holds items of weight 2^h. When the sketch exceeds its capacity,
+ * the lowest full level is sorted and every other item (random offset) is
+ * promoted to the next level. Rank error is about 1.7 / k with k = 200.
+ *
+ * T concept: copyable, less-than comparable
+ */
+template<class T>
+class KllSketch
+{
+    using self_type = KllSketch;
+public:
+    explicit KllSketch(std::size_t k = 200)
+        : k_(std::max<std::size_t>(k, 8))
+    {
+        resizeLevels(1);
+    }
+
+    void update(T const &t) {
+        levels_[0].push_back(t);
+        ++count_;
+        ++size_;
+        if ( size_ > capacity_ ) {
+            compress();
+        }
+    }
+
+    void merge(self_type const &other) {
+        if ( levels_.size() < other.levels_.size() ) {
+            resizeLevels(other.levels_.size());
+        }
+        for ( std::size_t h = 0; h < other.levels_.size(); ++h ) {
+            levels_[h].insert(levels_[h].end(),
+                    other.levels_[h].begin(), other.levels_[h].end());
+            size_ += other.levels_[h].size();
+        }
+        count_ += other.count_;
+        while ( size_ > capacity_ ) {
+            compress();
+        }
+    }
+
+    /* number of items seen, not the number of items retained */
+    std::size_t count() const {
+        return count_;
+    }
+
+    bool empty() const {
+        return count_ == 0;
+    }
+
+    /* q in [0, 1]; the sketch must not be empty */
+    T quantile(double q) const {
+        return quantiles({q}).front();
+    }
+
+    std::vector<T> quantiles(std::vector<double> const &qs) const {
+        auto weighted = sortedWeighted();
+        std::vector<T> res;
+        res.reserve(qs.size());
+        for ( double q : qs ) {
+            q = std::min(1.0, std::max(0.0, q));
+            auto target = static_cast<std::uint64_t>(q * (count_ - 1));
+            std::uint64_t acc = 0;
+            auto it = weighted.begin();
+            for ( ; it + 1 != weighted.end(); ++it ) {
+                acc += it->second;
+                if ( acc > target ) break;
+            }
+            res.push_back(it->first);
+        }
+        return res;
+    }
+
+    /* approximate fraction of items < t */
+    double rank(T const &t) const {
+        std::uint64_t below = 0;
+        for ( std::size_t h = 0; h < levels_.size(); ++h ) {
+            for ( auto const &e : levels_[h] ) {
+                if ( e < t ) below += std::uint64_t(1) << h;
+            }
+        }
+        return count_ == 0 ? 0.0 : 1.0 * below / count_;
+    }
+
+private:
+    /* capacities depend on the depth below the top level, so they only
+     * change when a level is added
+     */
+    void resizeLevels(std::size_t n) {
+        levels_.resize(n);
+        caps_.resize(n);
+        capacity_ = 0;
+        for ( std::size_t h = 0; h < n; ++h ) {
+            auto cap = std::ceil(k_ * std::pow(2.0 / 3.0, n - 1 - h));
+            caps_[h] = std::max<std::size_t>(2, static_cast<std::size_t>(cap));
+            capacity_ += caps_[h];
+        }
+    }
+
+    void compress() {
+        for ( std::size_t h = 0; h < levels_.size(); ++h ) {
+            if ( levels_[h].size() < caps_[h] ) continue;
+
+            if ( h + 1 == levels_.size() ) {
+                resizeLevels(levels_.size() + 1);
+            }
+            auto &cur = levels_[h];
+            auto &up = levels_[h + 1];
+            std::sort(cur.begin(), cur.end());
+
+            /* an odd item out stays at this level */
+            std::size_t odd = cur.size() % 2;
+            for ( std::size_t i = odd + coin(); i < cur.size(); i += 2 ) {
+                up.push_back(cur[i]);
+            }
+            size_ -= cur.size() - odd;
+            size_ += (cur.size() - odd) / 2;
+            cur.erase(cur.begin() + odd, cur.end());
+            return;
+        }
+    }
+
+    std::vector<std::pair<T, std::uint64_t>> sortedWeighted() const {
+        std::vector<std::pair<T, std::uint64_t>> weighted;
+        weighted.reserve(size_);
+        for ( std::size_t h = 0; h < levels_.size(); ++h ) {
+            for ( auto const &e : levels_[h] ) {
+                weighted.emplace_back(e, std::uint64_t(1) << h);
+            }
+        }
+        std::sort(weighted.begin(), weighted.end(),
+                [] (auto const &a, auto const &b) { return a.first < b.first; });
+        return weighted;
+    }
+
+    /* xorshift, a sketch does not need a good generator */
+    std::size_t coin() {
+        rng_ ^= rng_ << 13;
+        rng_ ^= rng_ >> 7;
+        rng_ ^= rng_ << 17;
+        return rng_ & 1;
+    }
+
+    std::size_t                     k_;
+    std::vector<std::vector<T>>     levels_;
+    std::vector<std::size_t>        caps_;
+    std::size_t                     capacity_ = 0;
+    std::size_t                     size_ = 0;
+    std::size_t                     count_ = 0;
+    std::uint64_t                   rng_ = 0x9e3779b97f4a7c15ULL;
+};
+
+template<class T>
+struct HeavyHitter {
+    T               t;
+    std::size_t     count = 0;
+    /* count overestimates the true frequency by at most error */
+    std::size_t     error = 0;
+    friend std::ostream &operator<<(std::ostream &os, HeavyHitter const &hh) {
+        os << "[" << hh.t << ":" << hh.count << "~" << hh.error << "]";
+        return os;
+    }
+};
+
+/*
+ * Space-Saving heavy hitters (Metwally, Agrawal, El Abbadi).
+ *
+ * Keeps k counters in a min-heap indexed by a hash map. An unseen item
+ * evicts the smallest counter and inherits its count as error. Every item
+ * with frequency > n / k is guaranteed to be kept.
+ *
+ * T concept: copyable, equality comparable, std::hash<T>
+ */
+template<class T>
+class SpaceSaving
+{
+    using self_type = SpaceSaving;
+public:
+    explicit SpaceSaving(std::size_t k)
+        : k_(std::max<std::size_t>(k, 1))
+    {
+        heap_.reserve(k_);
+        pos_.reserve(k_);
+    }
+
+    void update(T const &t, std::size_t weight = 1) {
+        count_ += weight;
+        auto found = pos_.find(t);
+        if ( found != pos_.end() ) {
+            heap_[found->second].count += weight;
+            siftDown(found->second);
+        } else if ( heap_.size() < k_ ) {
+            pos_.emplace(t, heap_.size());
+            heap_.push_back({t, weight, 0});
+            siftUp(heap_.size() - 1);
+        } else {
+            auto &min = heap_.front();
+            pos_.erase(min.t);
+            min.error = min.count;
+            min.count += weight;
+            min.t = t;
+            pos_.emplace(t, 0);
+            siftDown(0);
+        }
+    }
+
+    /* mergeable summaries (Agarwal et al.): an item missing on one side
+     * may have occurred up to that side's minimal count times
+     */
+    void merge(self_type const &other) {
+        std::size_t min_this = full() ? heap_.front().count : 0,
+                    min_other = other.full() ? other.heap_.front().count : 0;
+
+        std::unordered_map<T, HeavyHitter<T>> all;
+        for ( auto const &hh : heap_ ) {
+            all[hh.t] = {hh.t, hh.count + min_other, hh.error + min_other};
+        }
+        for ( auto const &hh : other.heap_ ) {
+            auto found = all.find(hh.t);
+            if ( found != all.end() ) {
+                found->second.count += hh.count - min_other;
+                found->second.error += hh.error - min_other;
+            } else {
+                all[hh.t] = {hh.t, hh.count + min_this, hh.error + min_this};
+            }
+        }
+
+        std::vector<HeavyHitter<T>> merged;
+        merged.reserve(all.size());
+        for ( auto &kv : all ) {
+            merged.push_back(std::move(kv.second));
+        }
+        auto keep = std::min(k_, merged.size());
+        std::partial_sort(merged.begin(), merged.begin() + keep, merged.end(),
+                [] (auto const &a, auto const &b) { return a.count > b.count; });
+        merged.resize(keep);
+
+        heap_.clear();
+        pos_.clear();
+        for ( auto &hh : merged ) {
+            pos_.emplace(hh.t, heap_.size());
+            heap_.push_back(std::move(hh));
+            siftUp(heap_.size() - 1);
+        }
+        count_ += other.count_;
+    }
+
+    /* the counters, most frequent first */
+    std::vector<HeavyHitter<T>> top() const {
+        auto res = heap_;
+        std::sort(res.begin(), res.end(),
+                [] (auto const &a, auto const &b) { return a.count > b.count; });
+        return res;
+    }
+
+    std::size_t count() const {
+        return count_;
+    }
+
+private:
+    bool full() const {
+        return heap_.size() == k_;
+    }
+
+    void swapAt(std::size_t i, std::size_t j) {
+        std::swap(heap_[i], heap_[j]);
+        pos_[heap_[i].t] = i;
+        pos_[heap_[j].t] = j;
+    }
+
+    void siftUp(std::size_t i) {
+        while ( i > 0 ) {
+            auto parent = (i - 1) / 2;
+            if ( heap_[parent].count <= heap_[i].count ) break;
+            swapAt(i, parent);
+            i = parent;
+        }
+    }
+
+    void siftDown(std::size_t i) {
+        for ( ;; ) {
+            auto smallest = i, l = 2 * i + 1, r = 2 * i + 2;
+            if ( l < heap_.size() && heap_[l].count < heap_[smallest].count ) smallest = l;
+            if ( r < heap_.size() && heap_[r].count < heap_[smallest].count ) smallest = r;
+            if ( smallest == i ) break;
+            swapAt(i, smallest);
+            i = smallest;
+        }
+    }
+
+    std::size_t                             k_;
+    std::vector<HeavyHitter<T>>             heap_;
+    std::unordered_map<T, std::size_t>      pos_;
+    std::size_t                             count_ = 0;
+};
+
+#endif /* _SKETCHES_HH_ */